@@ -0,0 +1,129 @@
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <stdio.h>
+#include <vector>
+#include "constants.h"
+
+// Build step that rasterises the printable ASCII glyphs of the HUD font into the header hud_atlas.h, so that the game
+// starts without finding, loading or rasterising a font. Run by make as ./bake_atlas FONT OUTPUT
+
+// Rounds 26.6 fixed point down to whole pixels
+
+int floor_pixels(long value) {
+    return (value & -64) / 64;
+};
+
+// Rounds 26.6 fixed point up to whole pixels
+
+int ceil_pixels(long value) {
+    return ((value + 63) & -64) / 64;
+};
+
+// One glyph's box in the atlas and how far the pen moves after it
+
+struct baked_glyph {
+    int x;
+    int y;
+    int w;
+    int h;
+    int advance;
+};
+
+// Each glyph is laid out as SDL_ttf lays out a single glyph: a box a line tall from the font's ascent down, as wide as
+// the glyph's advance or its ink if wider, with the ink on the baseline. The boxes are packed in rows glyph_atlas_width
+// pixels wide after a white block, like the atlas the game used to build from the font, and written as one byte of
+// coverage per pixel
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        printf("Usage: %s FONT OUTPUT\n", argv[0]);
+        return 1;
+    };
+    FT_Library library;
+    FT_Face face;
+    if (FT_Init_FreeType(&library) != 0 || FT_New_Face(library, argv[1], 0, &face) != 0 ||
+        FT_Set_Char_Size(face, 0, hud_font_points * 64, 0, 0) != 0) {
+        printf("Error opening font %s\n", argv[1]);
+        return 1;
+    };
+    int ascent = ceil_pixels(FT_MulFix(face->ascender, face->size->metrics.y_scale));
+    int descent = ceil_pixels(FT_MulFix(face->descender, face->size->metrics.y_scale));
+    int line_height = ascent - descent + 1;
+    const int glyph_count = hud_last_glyph - hud_first_glyph + 1;
+    baked_glyph glyphs[glyph_count];
+    std::vector<std::vector<unsigned char>> boxes(glyph_count);
+    int x = hud_white_block;
+    int y = 0;
+    for (int c = hud_first_glyph; c <= hud_last_glyph; c++) {
+        baked_glyph *glyph = &glyphs[c - hud_first_glyph];
+        if (FT_Load_Char(face, c, FT_LOAD_RENDER) != 0) {
+            *glyph = {0, 0, 0, 0, 0};
+            continue;
+        };
+        FT_GlyphSlot slot = face->glyph;
+        int min_x = floor_pixels(slot->metrics.horiBearingX);
+        int ink_left = min_x < 0 ? 0 : min_x;
+        glyph->advance = ceil_pixels(slot->metrics.horiAdvance);
+        int ink_right = ink_left + static_cast<int>(slot->bitmap.width);
+        glyph->w = ink_right > glyph->advance ? ink_right : glyph->advance;
+        glyph->h = line_height;
+        if (x + glyph->w > glyph_atlas_width) {
+            x = 0;
+            y += line_height;
+        };
+        glyph->x = x;
+        glyph->y = y;
+        x += glyph->w;
+        std::vector<unsigned char> *box = &boxes[c - hud_first_glyph];
+        box->assign(glyph->w * glyph->h, 0);
+        for (unsigned int row = 0; row < slot->bitmap.rows; row++) {
+            int to_y = ascent - slot->bitmap_top + row;
+            for (unsigned int column = 0; column < slot->bitmap.width; column++) {
+                int to_x = ink_left + column;
+                if (to_y >= 0 && to_y < glyph->h && to_x < glyph->w) {
+                    (*box)[to_y * glyph->w + to_x] = slot->bitmap.buffer[row * slot->bitmap.pitch + column];
+                };
+            };
+        };
+    };
+    int height = y + line_height;
+    std::vector<unsigned char> coverage(glyph_atlas_width * height, 0);
+    for (int row = 0; row < hud_white_block; row++) {
+        for (int column = 0; column < hud_white_block; column++) {
+            coverage[row * glyph_atlas_width + column] = 255;
+        };
+    };
+    for (int g = 0; g < glyph_count; g++) {
+        for (int row = 0; row < glyphs[g].h && glyphs[g].w > 0; row++) {
+            for (int column = 0; column < glyphs[g].w; column++) {
+                coverage[(glyphs[g].y + row) * glyph_atlas_width + glyphs[g].x + column] = boxes[g][row * glyphs[g].w + column];
+            };
+        };
+    };
+    FILE *file = fopen(argv[2], "w");
+    if (file == NULL) {
+        printf("Error writing atlas %s\n", argv[2]);
+        return 1;
+    };
+    fprintf(file, "// Generated by bake_atlas from %s at %i points. Do not edit\n\n", argv[1], hud_font_points);
+    fprintf(file, "const int baked_atlas_height = %i;\n", height);
+    fprintf(file, "const int baked_line_height = %i;\n\n", line_height);
+    fprintf(file, "// x, y, w, h and advance of each glyph from hud_first_glyph\n\n");
+    fprintf(file, "const int baked_glyphs[%i][5] = {\n", glyph_count);
+    for (int g = 0; g < glyph_count; g++) {
+        fprintf(file, "    {%i, %i, %i, %i, %i},\n", glyphs[g].x, glyphs[g].y, glyphs[g].w, glyphs[g].h, glyphs[g].advance);
+    };
+    fprintf(file, "};\n\n// Coverage of each pixel, glyph_atlas_width to a row\n\nconst unsigned char baked_coverage[%zu] = {", coverage.size());
+    for (size_t i = 0; i < coverage.size(); i++) {
+        fprintf(file, "%s%i,", i % 32 == 0 ? "\n    " : "", coverage[i]);
+    };
+    fprintf(file, "\n};\n");
+    bool written = !ferror(file);
+    if (fclose(file) != 0 || !written) {
+        printf("Error writing atlas %s\n", argv[2]);
+        return 1;
+    };
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+    return 0;
+};
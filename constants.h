@@ -12,10 +12,49 @@ const float forward_thruster_power = 200.0;
 const float angular_thruster_power = 2.5;
 
 const int scenario_max_objects = 512;
-const int points_per_object = 16;
+const int scenario_orb_limit = 1 << 24;
+const int spawn_per_tick = 1;
+const int min_points_per_object = 8;
+const int max_points_per_object = 64;
+const float lod_point_radius = 1.0;
+
+const int glyph_atlas_width = 512;
+const int hud_font_points = 24;
+const int hud_first_glyph = 32;
+const int hud_last_glyph = 126;
+const int hud_white_block = 4;
 const int millisecond_frame_delay = 10;
+const int default_frame_rate = 100;
+const int max_catch_up_ticks = 5;
+const int vsync_miss_limit = 30;
+const int vsync_recover_frames = 120;
+const double latch_max_seconds = 0.05;
+const int input_queue_size = 256;
+const unsigned int recording_magic = 0x43524c4e;
+const unsigned int recording_version = 5;
+const unsigned int world_magic = 0x444c574e;
+const unsigned int world_version = 2;
+const int prewarm_ticks = 1000;
+const float prewarm_clearance = 100.0;
+const int batch_chunk = 4;
+const long batch_max_ticks = 60000;
+const int batch_histogram_buckets = 20;
+const int batch_histogram_width = 50;
+const float autopilot_cruise_speed = 60.0;
+const float autopilot_horizon = 1.5;
+const float autopilot_margin = 5.0;
+const int profile_ring_size = 65536;
+const float profile_window_seconds = 1.0;
+const float profile_refresh_seconds = 0.5;
+const unsigned int spectator_magic = 0x5053524e;
+const unsigned int spectator_version = 1;
+const float spectator_position_scale = 64.0;
+const float spectator_radius_scale = 256.0;
+const int default_spectator_rate = 30;
+const int spectator_backlog = 16;
+const double spectator_linger_seconds = 1.0;
 
-const float PI = 3.141592;
+constexpr float PI = 3.141592;
 
 const float view_max_angle = PI / 2.5;
 
@@ -26,7 +65,25 @@ const float object_min_radius = 10.0;
 const float object_max_radius = 20.0;
 
 const float deceleration_rate = 0.4;
+const float player_radius = 0.0;
+
+const int cache_line_size = 64;
+const int integrate_chunk = 16384;
+const int respawn_chunk = 1024;
+
+const float grid_cell_size = 50.0;
+const int grid_max_cells_per_axis = 128;
+const int grid_view_block = 4;
+const int sweep_chunk = 64;
+
+
+const int raster_tile_size = 64;
+const int raster_font_scale = 2;
+const unsigned int raster_hud_colour = 0x006464;
+const int default_frame_every = 100;
 
 const bool ignore_losing = false;
 
-const float angular_change = angular_thruster_power * millisecond_frame_delay / 1000.0f;
\ No newline at end of file
+const unsigned int default_seed = 27183;
+const int benchmark_window_size = 800;
+const float collision_benchmark_spacing = 50.0;
\ No newline at end of file
@@ -1,8 +1,36 @@
+#ifndef HEADLESS
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_ttf.h>
+#endif
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdio.h>
 #include "constants.h"
+#ifndef HEADLESS
+#include "hud_atlas.h"
+#endif
 #include <math.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 // Represents a point in space using cartesian coordinates
 
@@ -12,7 +40,7 @@ struct point {
     float z;
 };
 
-// Represents the position, size and movement of a specific orb
+// Represents the position, size and movement of a specific orb as it is spawned
 
 struct flying_object {
     point centre;
@@ -52,455 +80,4704 @@ int max(int a, int b) {
     return a > b ? a : b;
 };
 
-// Calculates if a flying object should be visible to the player, and if so where on screen
-// Does not calculate the determinant as it expects the perspectove basis vectors to always be orthonormal
+// Returns the minimum of 2 integers
+
+int min(int a, int b) {
+    return a > b ? b : a;
+};
+
+// Returns a high resolution time in seconds from an arbitrary starting point
+
+double now_seconds() {
+#ifndef HEADLESS
+    return static_cast<double>(SDL_GetPerformanceCounter()) / static_cast<double>(SDL_GetPerformanceFrequency());
+#else
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+};
+
+#ifdef PROFILE
+
+// Parts of a frame or tick timed when built with PROFILE. Frame phases run on the render thread and tick phases on the
+// simulation thread
+
+enum profile_phase {
+    phase_events,
+    phase_view,
+    phase_sort,
+    phase_batch,
+    phase_raster,
+    phase_hud,
+    phase_submit,
+    phase_present,
+    phase_pace,
+    phase_tick,
+    phase_integrate,
+    phase_respawn,
+    phase_grid,
+    phase_collide,
+    phase_record,
+    phase_snapshot,
+    phase_serve,
+    profile_phases
+};
+
+const char *profile_phase_names[profile_phases] = {
+    "events", "view", "sort", "batch", "raster", "hud", "submit", "present", "pace",
+    "tick", "integrate", "respawn", "grid", "collide", "record", "snapshot", "serve"
+};
+
+// One timed scope, with start and end in nanoseconds from an arbitrary starting point
+
+struct profile_event {
+    int phase;
+    int thread;
+    long long start;
+    long long end;
+};
+
+// Slot of the ring holding one event. sequence is one more than the event's position in the ring once it is completely
+// written and 0 while it is being written, so readers can skip slots they caught half way
+
+struct profile_slot {
+    std::atomic<unsigned long long> sequence;
+    std::atomic<int> phase;
+    std::atomic<int> thread;
+    std::atomic<long long> start;
+    std::atomic<long long> end;
+};
+
+// Ring of the most recent profile_ring_size events from every thread. Writers claim a slot by counting up next, so
+// none ever waits for another, and the oldest events are overwritten
+
+struct profile_ring {
+    profile_slot slots[profile_ring_size];
+    std::atomic<unsigned long long> next;
+    std::atomic<int> threads;
+};
+
+profile_ring profiler;
+thread_local int profile_thread = -1;
+const char *profile_path = NULL;
 
-void render_object(flying_object *object, int h, int w, SDL_Renderer *renderer, float x, float y, float z, point *forward, point *right, point *up) {
+// Returns a steady time in nanoseconds for profiling
 
-    SDL_Vertex centre;
+long long profile_clock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+};
 
-    float scale = static_cast<float>(max(h, w));
+// Adds a timed scope to the ring
 
-    point separation_vector = {
-        x : object->centre.x - x,
-        y : object->centre.y - y,
-        z : object->centre.z - z
+void record_profile(int phase, long long start, long long end) {
+    if (profile_thread < 0) {
+        profile_thread = profiler.threads++;
     };
+    unsigned long long position = profiler.next++;
+    profile_slot *slot = &profiler.slots[position % profile_ring_size];
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->phase.store(phase, std::memory_order_relaxed);
+    slot->thread.store(profile_thread, std::memory_order_relaxed);
+    slot->start.store(start, std::memory_order_relaxed);
+    slot->end.store(end, std::memory_order_relaxed);
+    slot->sequence.store(position + 1, std::memory_order_release);
+};
 
-    float adjoint[3][3] = {{right->y * up->z - right->z * up->y,
-                            forward->z * up->y - forward->y * up->z,
-                            forward->y * right->z - forward->z * right->y},
-                           {right->z * up->x - right->x * up->z,
-                            forward->x * up->z - forward->z * up->x,
-                            forward->z * right->x - forward->x * right->z},
-                           {right->x * up->y - right->y * up->x,
-                            forward->y * up->x - forward->x * up->y,
-                            forward->x * right->y - forward->y * right->x}};
+// Copies the events still in the ring that ended at or after since into out, oldest first
 
-    point converted_separation_vector = {
-        x : (separation_vector.x * adjoint[0][0] + separation_vector.y * adjoint[1][0] + separation_vector.z * adjoint[2][0]),
-        y : (separation_vector.x * adjoint[0][1] + separation_vector.y * adjoint[1][1] + separation_vector.z * adjoint[2][1]),
-        z : (separation_vector.x * adjoint[0][2] + separation_vector.y * adjoint[1][2] + separation_vector.z * adjoint[2][2])
+void read_profile(std::vector<profile_event> *out, long long since) {
+    out->clear();
+    unsigned long long next = profiler.next.load();
+    unsigned long long first = next > static_cast<unsigned long long>(profile_ring_size) ? next - profile_ring_size : 0;
+    for (unsigned long long position = first; position < next; position++) {
+        profile_slot *slot = &profiler.slots[position % profile_ring_size];
+        if (slot->sequence.load(std::memory_order_acquire) != position + 1) {
+            continue;
+        };
+        profile_event event = {
+            phase : slot->phase.load(std::memory_order_relaxed),
+            thread : slot->thread.load(std::memory_order_relaxed),
+            start : slot->start.load(std::memory_order_relaxed),
+            end : slot->end.load(std::memory_order_relaxed)
+        };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) == position + 1 && event.end >= since) {
+            out->push_back(event);
+        };
     };
+};
 
-    if (converted_separation_vector.x <= 0) {
-        return;
+// Times the scope it is declared in as one event of phase
+
+struct profile_scope {
+    int phase;
+    long long start;
+
+    profile_scope(int timed) {
+        phase = timed;
+        start = profile_clock();
     };
 
-    centre = {
-        position : {
-            x : (scale * converted_separation_vector.y / sqrt(converted_separation_vector.x * converted_separation_vector.x + converted_separation_vector.z * converted_separation_vector.z)) + static_cast<float>(w / 2),
-            y : (scale * converted_separation_vector.z / sqrt(converted_separation_vector.x * converted_separation_vector.x + converted_separation_vector.y * converted_separation_vector.y)) + static_cast<float>(h / 2)
-        },
+    ~profile_scope() {
+        record_profile(phase, start, profile_clock());
+    };
+};
+
+// Percentiles of each phase's duration in milliseconds over the events of a recent window
+
+struct profile_stats {
+    int counts[profile_phases];
+    float p50[profile_phases];
+    float p95[profile_phases];
+    float p99[profile_phases];
+};
+
+// Works out each phase's percentiles over the events that ended in the last window seconds
+
+void summarise_profile(profile_stats *stats, double window) {
+    std::vector<profile_event> events;
+    read_profile(&events, profile_clock() - static_cast<long long>(window * 1e9));
+    std::vector<float> durations[profile_phases];
+    for (profile_event &event : events) {
+        durations[event.phase].push_back((event.end - event.start) / 1e6f);
+    };
+    for (int phase = 0; phase < profile_phases; phase++) {
+        std::vector<float> &sorted = durations[phase];
+        std::sort(sorted.begin(), sorted.end());
+        int count = sorted.size();
+        stats->counts[phase] = count;
+        stats->p50[phase] = count > 0 ? sorted[count / 2] : 0;
+        stats->p95[phase] = count > 0 ? sorted[min(count - 1, count * 95 / 100)] : 0;
+        stats->p99[phase] = count > 0 ? sorted[min(count - 1, count * 99 / 100)] : 0;
+    };
+};
+
+// Writes every event still in the ring to path, as CSV if path ends in .csv or as Chrome trace JSON otherwise
+// Times are in microseconds from the first event
+
+bool export_profile(const char *path) {
+    std::vector<profile_event> events;
+    read_profile(&events, 0);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error writing profile %s\n", path);
+        return false;
+    };
+    long long origin = events.empty() ? 0 : events[0].start;
+    for (profile_event &event : events) {
+        origin = event.start < origin ? event.start : origin;
+    };
+    size_t length = strlen(path);
+    bool csv = length >= 4 && strcmp(path + length - 4, ".csv") == 0;
+    if (csv) {
+        fprintf(file, "phase,thread,start_us,duration_us\n");
+    } else {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    };
+    for (size_t i = 0; i < events.size(); i++) {
+        profile_event &event = events[i];
+        double start = (event.start - origin) / 1e3;
+        double duration = (event.end - event.start) / 1e3;
+        if (csv) {
+            fprintf(file, "%s,%i,%.3f,%.3f\n", profile_phase_names[event.phase], event.thread, start, duration);
+        } else {
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}", i == 0 ? "" : ",",
+                    profile_phase_names[event.phase], event.thread, start, duration);
+        };
+    };
+    if (!csv) {
+        fprintf(file, "\n]}\n");
+    };
+    fclose(file);
+    printf("Wrote %zu profile events to %s\n", events.size(), path);
+    return true;
+};
+
+// Exports the profile to profile_path when the program ends
+
+void export_profile_at_exit() {
+    export_profile(profile_path);
+};
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profile_scope_, line)
+#define PROFILE_SCOPE(phase) profile_scope PROFILE_NAME(__LINE__)(phase)
+
+#else
+
+// Without PROFILE the timers compile to nothing
+
+#define PROFILE_SCOPE(phase)
+
+#endif
+
+// Sine evaluated by Taylor series, so that lookup tables can be built at compile time
+
+constexpr double constexpr_sin(double angle) {
+    while (angle > PI) {
+        angle -= 2.0 * PI;
+    };
+    while (angle < -PI) {
+        angle += 2.0 * PI;
+    };
+    double term = angle;
+    double sum = angle;
+    for (int n = 1; n < 12; n++) {
+        term *= -angle * angle / ((2 * n) * (2 * n + 1));
+        sum += term;
+    };
+    return sum;
+};
+
+// Offsets of the rim points of a circle of radius 1, in the order orbs are drawn
+
+struct circle_table {
+    int points;
+    float sin[max_points_per_object];
+    float cos[max_points_per_object];
+};
+
+// Builds the rim offsets for a number of evenly spaced points
+
+constexpr circle_table make_circle_table(int points) {
+    circle_table table = {};
+    table.points = points;
+    for (int i = 0; i < points; i++) {
+        double angle = i * 2.0 * PI / points;
+        table.sin[i] = constexpr_sin(angle);
+        table.cos[i] = constexpr_sin(angle + PI / 2.0);
+    };
+    return table;
+};
+
+// One table per level of detail, each with twice the points of the one before
+
+constexpr circle_table unit_circles[] = {
+    make_circle_table(min_points_per_object),
+    make_circle_table(min_points_per_object * 2),
+    make_circle_table(min_points_per_object * 4),
+    make_circle_table(min_points_per_object * 8)
+};
+
+static_assert(min_points_per_object * 8 == max_points_per_object, "unit_circles must end at max_points_per_object");
+
+// Picks the coarsest table whose polygon stays within about half a pixel of a true circle of the given radius in pixels
+// A polygon with n points strays r * (1 - cos(PI / n)), roughly r * PI^2 / 2n^2, from the circle, so n needs to reach PI * sqrt(r)
+
+const circle_table *circle_for_radius(float radius) {
+    float needed = PI * sqrt(radius);
+    int level = 0;
+    while (level < 3 && unit_circles[level].points < needed) {
+        level++;
+    };
+    return &unit_circles[level];
+};
+
+#ifndef HEADLESS
+
+// Geometry for everything drawn in a frame, submitted with a single SDL_RenderGeometry call
+// The vectors are kept between frames so their memory is reused once they have grown to fit a frame
+
+// white is where untextured geometry samples the frame's texture, so orbs and text can share one draw call
+
+struct geometry_batch {
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    SDL_FPoint white;
+};
+
+// Empties a batch for a new frame without releasing its memory
+
+void clear_batch(geometry_batch *batch) {
+    batch->vertices.clear();
+    batch->indices.clear();
+};
+
+// Adds a disc as a fan around a centre vertex, with each rim vertex shared by the two triangles either side of it
+// The number of rim points follows the disc's size on screen, and discs under lod_point_radius pixels become a single quad
+
+void batch_disc(geometry_batch *batch, float x, float y, float radius) {
+    int centre = batch->vertices.size();
+    if (radius < lod_point_radius) {
+        float half = fmax(radius, 0.5f);
+        SDL_Color colour = {170, 0, 85, 255};
+        batch->vertices.push_back({position : {x - half, y - half}, color : colour, tex_coord : batch->white});
+        batch->vertices.push_back({position : {x + half, y - half}, color : colour, tex_coord : batch->white});
+        batch->vertices.push_back({position : {x + half, y + half}, color : colour, tex_coord : batch->white});
+        batch->vertices.push_back({position : {x - half, y + half}, color : colour, tex_coord : batch->white});
+        const int quad[6] = {0, 1, 2, 0, 2, 3};
+        for (int corner : quad) {
+            batch->indices.push_back(centre + corner);
+        };
+        return;
+    };
+    const circle_table *circle = circle_for_radius(radius);
+    batch->vertices.push_back({
+        position : {x, y},
         color : {
             r : 0,
             g : 0,
             b : 255,
             a : 255
-        }
-    };
-    SDL_Vertex to_print[points_per_object * 3];
-    float distance = scale * object->radius / sqrt(converted_separation_vector.x * converted_separation_vector.x + converted_separation_vector.y * converted_separation_vector.y + converted_separation_vector.z * converted_separation_vector.z);
-    for (int i = 0; i < points_per_object; i++) {
-        to_print[i * 3] = {
+        },
+        tex_coord : batch->white
+    });
+    for (int i = 0; i < circle->points; i++) {
+        batch->vertices.push_back({
             position : {
-                x : centre.position.x + distance * sin(i * 2 * PI / static_cast<float>(points_per_object)),
-                y : centre.position.y + distance * cos(i * 2 * PI / static_cast<float>(points_per_object)),
+                x : x + radius * circle->sin[i],
+                y : y + radius * circle->cos[i]
             },
             color : {255, 0, 0, 255},
+            tex_coord : batch->white
+        });
+    };
+    for (int i = 0; i < circle->points; i++) {
+        batch->indices.push_back(centre + 1 + i);
+        batch->indices.push_back(centre + 1 + (i + 1) % circle->points);
+        batch->indices.push_back(centre);
+    };
+};
+
+// Draws everything in a batch in one call, sampling texture
+
+void submit_batch(geometry_batch *batch, SDL_Renderer *renderer, SDL_Texture *texture) {
+    if (batch->indices.empty()) {
+        return;
+    };
+    SDL_RenderGeometry(renderer, texture, batch->vertices.data(), batch->vertices.size(), batch->indices.data(), batch->indices.size());
+};
+
+// The printable ASCII glyphs of the HUD font in one texture, plus a small white block for untextured geometry
+// Glyphs are white so that vertex colours tint them
+
+struct glyph_atlas {
+    SDL_Texture *texture;
+    int w;
+    int h;
+    int line_height;
+    SDL_Rect glyphs[128];
+    int advances[128];
+    SDL_FPoint white;
+};
+
+// Makes the atlas texture from the glyphs bake_atlas rasterised into the binary at build time, with each pixel's
+// baked coverage as its alpha, so that no font is loaded or rasterised at startup
+
+bool build_atlas(glyph_atlas *atlas, SDL_Renderer *renderer) {
+    atlas->w = glyph_atlas_width;
+    atlas->h = baked_atlas_height;
+    atlas->line_height = baked_line_height;
+    for (int c = hud_first_glyph; c <= hud_last_glyph; c++) {
+        const int *glyph = baked_glyphs[c - hud_first_glyph];
+        atlas->glyphs[c] = {glyph[0], glyph[1], glyph[2], glyph[3]};
+        atlas->advances[c] = glyph[4];
+    };
+    std::vector<unsigned char> pixels(sizeof(baked_coverage) * 4, 255);
+    for (size_t i = 0; i < sizeof(baked_coverage); i++) {
+        pixels[i * 4 + 3] = baked_coverage[i];
+    };
+    atlas->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, atlas->w, atlas->h);
+    if (atlas->texture == NULL) {
+        return false;
+    };
+    SDL_UpdateTexture(atlas->texture, NULL, pixels.data(), atlas->w * 4);
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    atlas->white = {
+        x : hud_white_block * 0.5f / atlas->w,
+        y : hud_white_block * 0.5f / atlas->h
+    };
+    return true;
+};
+
+// One line of HUD text laid out as quads from the atlas, only laid out again when its text or anchor changes
+
+struct hud_line {
+    char text[64];
+    int anchor;
+    int top;
+    bool left;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+
+// Lays out text with its top at y = top, starting at x = anchor if left or ending there otherwise
+
+void layout_line(hud_line *line, glyph_atlas *atlas, const char *text, bool left, int anchor, int top, SDL_Color colour) {
+    if (strcmp(line->text, text) == 0 && line->left == left && line->anchor == anchor && line->top == top && !line->vertices.empty()) {
+        return;
+    };
+    snprintf(line->text, sizeof(line->text), "%s", text);
+    line->left = left;
+    line->anchor = anchor;
+    line->top = top;
+    line->vertices.clear();
+    line->indices.clear();
+    int width = 0;
+    for (const char *c = line->text; *c; c++) {
+        if (*c >= hud_first_glyph && *c <= hud_last_glyph) {
+            width += atlas->advances[static_cast<int>(*c)];
         };
-        to_print[i * 3 + 1] = {
-            position : {
-                x : centre.position.x + distance * sin((i + 1) * 2 * PI / static_cast<float>(points_per_object)),
-                y : centre.position.y + distance * cos((i + 1) * 2 * PI / static_cast<float>(points_per_object)),
-            },
-            color : {255, 0, 0, 255},
+    };
+    float pen = left ? anchor : anchor - width;
+    for (const char *c = line->text; *c; c++) {
+        if (*c < hud_first_glyph || *c > hud_last_glyph) {
+            continue;
+        };
+        SDL_Rect *glyph = &atlas->glyphs[static_cast<int>(*c)];
+        if (glyph->w > 0) {
+            float u0 = static_cast<float>(glyph->x) / atlas->w;
+            float v0 = static_cast<float>(glyph->y) / atlas->h;
+            float u1 = static_cast<float>(glyph->x + glyph->w) / atlas->w;
+            float v1 = static_cast<float>(glyph->y + glyph->h) / atlas->h;
+            int first = line->vertices.size();
+            float y0 = top;
+            float y1 = top + glyph->h;
+            line->vertices.push_back({position : {pen, y0}, color : colour, tex_coord : {u0, v0}});
+            line->vertices.push_back({position : {pen + glyph->w, y0}, color : colour, tex_coord : {u1, v0}});
+            line->vertices.push_back({position : {pen + glyph->w, y1}, color : colour, tex_coord : {u1, v1}});
+            line->vertices.push_back({position : {pen, y1}, color : colour, tex_coord : {u0, v1}});
+            const int quad[6] = {0, 1, 2, 0, 2, 3};
+            for (int corner : quad) {
+                line->indices.push_back(first + corner);
+            };
+        };
+        pen += atlas->advances[static_cast<int>(*c)];
+    };
+};
+
+// Appends a laid out line to a batch
+
+void batch_line(geometry_batch *batch, hud_line *line) {
+    int first = batch->vertices.size();
+    batch->vertices.insert(batch->vertices.end(), line->vertices.begin(), line->vertices.end());
+    for (int index : line->indices) {
+        batch->indices.push_back(first + index);
+    };
+};
+
+#endif
+
+// Counter based random numbers. Each stream is keyed by the world seed, the orb slot it is for and the tick, so a spawn
+// draws the same numbers whichever thread runs it and in whatever order spawns happen
+
+struct random_stream {
+    unsigned long long counter;
+};
+
+// Scrambles the bits of a 64 bit value (the splitmix64 finaliser)
+
+unsigned long long mix_bits(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+};
+
+// Returns the stream for spawning into slot orb during tick
+
+random_stream make_stream(unsigned long long seed, unsigned long long orb, unsigned long long tick) {
+    return {mix_bits(seed ^ mix_bits(orb * 0x9E3779B97F4A7C15ULL ^ mix_bits(tick + 0x632BE59BD9B4E019ULL)))};
+};
+
+// Returns the next random float in [0, 1) from a stream
+
+float random_unit(random_stream *stream) {
+    stream->counter += 0x9E3779B97F4A7C15ULL;
+    return static_cast<float>(mix_bits(stream->counter) >> 40) / 16777216.0f;
+};
+
+// Returns a random float between [min, max)
+
+float random_place(float min, float max, random_stream *stream) {
+    return min + (max - min) * random_unit(stream);
+};
+
+// Everything that describes a world: the boundary box, how many orbs fly in it and how fast they arrive, and the
+// spread of their sizes and speeds. Each size and speed is min + (max - min) * u^skew for u uniform in [0, 1), so a skew
+// above 1 favours small values and below 1 large ones
+
+struct scenario {
+    point low;
+    point high;
+    int max_objects;
+    int spawn_rate;
+    float min_radius;
+    float max_radius;
+    float radius_skew;
+    float min_velocity;
+    float max_velocity;
+    float velocity_skew;
+    bool orb_collisions;
+};
+
+// Returns the standard scenario from constants.h, holding up to max_objects orbs
+
+scenario default_scenario(int max_objects = scenario_max_objects) {
+    return {
+        low : {boundary_x_low, boundary_y_low, boundary_z_low},
+        high : {boundary_x_high, boundary_y_high, boundary_z_high},
+        max_objects : max_objects,
+        spawn_rate : spawn_per_tick,
+        min_radius : object_min_radius,
+        max_radius : object_max_radius,
+        radius_skew : 1.0,
+        min_velocity : min_velocity,
+        max_velocity : max_velocity,
+        velocity_skew : 1.0,
+        orb_collisions : false
+    };
+};
+
+// Returns true if every value in world is in range for a game: a box with some size, a sensible number of orbs, and
+// radii, speeds and skews the grid and spawning can work with
+
+bool valid_scenario(const scenario *world) {
+    return world->low.x < world->high.x && world->low.y < world->high.y && world->low.z < world->high.z &&
+           world->max_objects > 0 && world->max_objects <= scenario_orb_limit && world->spawn_rate > 0 && world->min_radius > 0 &&
+           world->min_radius <= world->max_radius && world->radius_skew > 0 && world->min_velocity >= 0 &&
+           world->min_velocity <= world->max_velocity && world->velocity_skew > 0;
+};
+
+// Reads a scenario from a text file of "name value..." lines over the defaults, ignoring blank lines and # comments
+// Returns false, saying why, if the file cannot be read or holds anything unrecognised or out of range
+
+bool load_scenario(scenario *world, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Error opening scenario %s\n", path);
+        return false;
+    };
+    *world = default_scenario();
+    char line[256];
+    int number = 0;
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        };
+        char name[32];
+        int offset = 0;
+        if (sscanf(line, " %31s%n", name, &offset) != 1) {
+            continue;
+        };
+        const char *values = line + offset;
+        if (strcmp(name, "box") == 0) {
+            valid = sscanf(values, "%f %f %f %f %f %f", &world->low.x, &world->low.y, &world->low.z,
+                           &world->high.x, &world->high.y, &world->high.z) == 6;
+        } else if (strcmp(name, "orbs") == 0) {
+            valid = sscanf(values, "%i", &world->max_objects) == 1;
+        } else if (strcmp(name, "spawn_rate") == 0) {
+            valid = sscanf(values, "%i", &world->spawn_rate) == 1;
+        } else if (strcmp(name, "radius") == 0) {
+            valid = sscanf(values, "%f %f %f", &world->min_radius, &world->max_radius, &world->radius_skew) >= 2;
+        } else if (strcmp(name, "speed") == 0) {
+            valid = sscanf(values, "%f %f %f", &world->min_velocity, &world->max_velocity, &world->velocity_skew) >= 2;
+        } else if (strcmp(name, "collide") == 0) {
+            int collide;
+            valid = sscanf(values, "%i", &collide) == 1;
+            world->orb_collisions = collide != 0;
+        } else {
+            valid = false;
         };
-        to_print[i * 3 + 2] = centre;
     };
-    SDL_RenderGeometry(renderer, NULL, to_print, points_per_object * 3, NULL, 0);
+    fclose(file);
+    valid = valid && valid_scenario(world);
+    if (!valid) {
+        printf("Error in scenario %s at line %i\n", path, number);
+    };
+    return valid;
 };
 
-// Returns a random float between [min, max]
+// Returns a random float in [min, max) drawn with the given skew
 
-float random_place(float min, float max) {
-    return min + (max - min) * static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+float random_skewed(float min, float max, float skew, random_stream *stream) {
+    float unit = random_unit(stream);
+    return min + (max - min) * (skew == 1.0f ? unit : powf(unit, skew));
 };
 
-// Creates a new orb at a random point on the boundary surface with random movement properties and radius within the bounds defined in constants.h
+// Creates a new orb at a random point on the boundary surface with random movement properties and radius within the bounds of the world
 
-void create_object(flying_object *shell) {
-    int flag = rand() % 6;
+void create_object(flying_object *shell, scenario *world, random_stream *stream) {
+    int flag = static_cast<int>(random_unit(stream) * 6.0f);
     point centre;
     switch (flag) {
         case 0:
             centre = {
-                x : boundary_x_low,
-                y : random_place(boundary_y_low, boundary_y_high),
-                z : random_place(boundary_z_low, boundary_z_high)
+                x : world->low.x,
+                y : random_place(world->low.y, world->high.y, stream),
+                z : random_place(world->low.z, world->high.z, stream)
             };
             break;
         case 1:
             centre = {
-                x : boundary_x_high,
-                y : random_place(boundary_y_low, boundary_y_high),
-                z : random_place(boundary_z_low, boundary_z_high)
+                x : world->high.x,
+                y : random_place(world->low.y, world->high.y, stream),
+                z : random_place(world->low.z, world->high.z, stream)
             };
             break;
         case 2:
             centre = {
-                x : random_place(boundary_x_low, boundary_x_high),
-                y : boundary_y_low,
-                z : random_place(boundary_z_low, boundary_z_high)
+                x : random_place(world->low.x, world->high.x, stream),
+                y : world->low.y,
+                z : random_place(world->low.z, world->high.z, stream)
             };
             break;
         case 3:
             centre = {
-                x : random_place(boundary_x_low, boundary_x_high),
-                y : boundary_y_high,
-                z : random_place(boundary_z_low, boundary_z_high)
+                x : random_place(world->low.x, world->high.x, stream),
+                y : world->high.y,
+                z : random_place(world->low.z, world->high.z, stream)
             };
             break;
         case 4:
             centre = {
-                x : random_place(boundary_x_low, boundary_x_high),
-                y : random_place(boundary_y_low, boundary_y_high),
-                z : boundary_z_low
+                x : random_place(world->low.x, world->high.x, stream),
+                y : random_place(world->low.y, world->high.y, stream),
+                z : world->low.z
             };
             break;
-        case 5:
+        default:
             centre = {
-                x : random_place(boundary_x_low, boundary_x_high),
-                y : random_place(boundary_y_low, boundary_y_high),
-                z : boundary_z_high
+                x : random_place(world->low.x, world->high.x, stream),
+                y : random_place(world->low.y, world->high.y, stream),
+                z : world->high.z
             };
             break;
     };
-    shell->azimuth = (2.0f * PI * static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) - PI;
-    shell->inclination = (PI * static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) - (PI / 2.0f);
-    shell->velocity = min_velocity + (max_velocity - min_velocity) * static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+    shell->azimuth = (2.0f * PI * random_unit(stream)) - PI;
+    shell->inclination = (PI * random_unit(stream)) - (PI / 2.0f);
+    shell->velocity = random_skewed(world->min_velocity, world->max_velocity, world->velocity_skew, stream);
     shell->centre = {
         x : centre.x,
         y : centre.y,
         z : centre.z
     };
-    shell->radius = object_min_radius + (object_max_radius - object_min_radius) * (static_cast<float>(rand()) / static_cast<float>(RAND_MAX));
+    shell->radius = random_skewed(world->min_radius, world->max_radius, world->radius_skew, stream);
 };
 
-// Determines if an orb or the player is outside the boundary and should be killed
+// Determines if an orb or the player is outside the box from low to high and should be killed
 
-bool out_of_bounds(float x, float y, float z, float tolerance) {
-    return x > boundary_x_high + tolerance || x < boundary_x_low - tolerance ||
-           y > boundary_y_high + tolerance || y < boundary_y_low - tolerance ||
-           z > boundary_z_high + tolerance || z < boundary_z_low - tolerance;
+bool out_of_bounds(point *low, point *high, float x, float y, float z, float tolerance) {
+    return x > high->x + tolerance || x < low->x - tolerance ||
+           y > high->y + tolerance || y < low->y - tolerance ||
+           z > high->z + tolerance || z < low->z - tolerance;
 };
 
-// Converts a vector to unit length
+// Orbs in flight, stored as one array per attribute so the per tick loop streams through memory and vectorises
+// The velocity is kept in cartesian form per second. It only changes when orbs bounce off each other
+// cell is the spatial grid cell each orb is currently filed under, or -1 if it has not been filed yet
+// respawn lists the slots freed by orbs leaving the box each tick, which are refilled in bulk by new orbs
+// Every array is carved from one arena allocated up front, so the storage never allocates again however the world churns
 
-void normalise(point *a) {
-    float divisor = sqrt(a->x * a->x + a->y * a->y + a->z * a->z);
-    a->x = a->x / divisor;
-    a->y = a->y / divisor;
-    a->z = a->z / divisor;
+struct orb_storage {
+    float *x;
+    float *y;
+    float *z;
+    float *velocity_x;
+    float *velocity_y;
+    float *velocity_z;
+    float *radius;
+    int *cell;
+    int *respawn;
+    int *moved;
+    void *arena;
 };
 
-// Internal struct to support merge sort
+// Width in floats that every orb array is padded and aligned to, matching the widest vector register the kernel uses
 
-struct index_distance {
-    int index;
-    float distance;
-};
+const int orb_lane_width = 8;
 
-// Merge sort implementation to allow rendering to print closer orbs on top of far orbs
+// Allocates the arena of an orb storage for up to capacity orbs, with each array starting on its own cache line
+// A game cannot run without its orbs, so failing to allocate them ends the program
 
-void index_sort(int start, int end, index_distance* arr) {
-    if (end - start < 2) {
-        return;
-    };
-    if (end - start == 2) {
-        if (arr[start].distance < arr[start + 1].distance) {
-            index_distance tmp = arr[start];
-            arr[start] = arr[start + 1];
-            arr[start + 1] = tmp;
-        };
-        return;
-    };
-    index_sort(start, start + (end - start) / 2, arr);
-    index_sort(start + (end - start) / 2, end, arr);
-    index_distance out[end - start];
-    int i = 0;
-    int pointer_1 = 0;
-    int pointer_2 = (end - start) / 2;
-    while (pointer_1 < (end - start) / 2 && pointer_2 < end - start) {
-        if (arr[start + pointer_1].distance > arr[start + pointer_2].distance) {
-            out[i] = arr[start + pointer_1];
-            pointer_1++;
-        } else {
-            out[i] = arr[start + pointer_2];
-            pointer_2++;
-        };
-        i++;
+void allocate_orbs(orb_storage *orbs, int capacity) {
+    size_t padded = ((capacity + orb_lane_width - 1) / orb_lane_width) * orb_lane_width * sizeof(float);
+    padded = (padded + cache_line_size - 1) / cache_line_size * cache_line_size;
+    float **fields[] = {&orbs->x, &orbs->y, &orbs->z, &orbs->velocity_x, &orbs->velocity_y, &orbs->velocity_z, &orbs->radius};
+    int **lists[] = {&orbs->cell, &orbs->respawn, &orbs->moved};
+    char *arena = static_cast<char *>(aligned_alloc(cache_line_size, padded * 10));
+    if (arena == NULL) {
+        printf("Error allocating storage for %i orbs\n", capacity);
+        exit(1);
     };
-    while (pointer_1 < (end - start) / 2) {
-        out[i] = arr[start + pointer_1];
-        pointer_1++;
-        i++;
+    orbs->arena = arena;
+    for (float **field : fields) {
+        *field = reinterpret_cast<float *>(arena);
+        arena += padded;
     };
-    while (pointer_2 < end - start) {
-        out[i] = arr[start + pointer_2];
-        pointer_2++;
-        i++;
+    for (int **list : lists) {
+        *list = reinterpret_cast<int *>(arena);
+        arena += padded;
     };
-    for (int j = 0; j < end - start; j++) {
-        arr[start + j] = out[j];
+};
+
+// Frees the arena of an orb storage
+
+void free_orbs(orb_storage *orbs) {
+    free(orbs->arena);
+};
+
+// Writes a newly created orb into slot index of the storage, converting its movement to cartesian once
+
+void store_object(orb_storage *orbs, int index, flying_object *object) {
+    movement_charcteristics movement = {
+        azimuth : object->azimuth,
+        inclination : object->inclination,
+        velocity : object->velocity
     };
+    point velocity = to_cartesian(&movement);
+    orbs->x[index] = object->centre.x;
+    orbs->y[index] = object->centre.y;
+    orbs->z[index] = object->centre.z;
+    orbs->velocity_x[index] = velocity.x;
+    orbs->velocity_y[index] = velocity.y;
+    orbs->velocity_z[index] = velocity.z;
+    orbs->radius[index] = object->radius;
 };
 
-// Main game state class
+// Uniform grid over the boundary box holding the orbs in each cell, kept up to date as orbs move between cells
+// Orbs slightly outside the box are kept in the nearest edge cell. Each cell is a list threaded through the orbs: first is
+// the first orb in each cell or -1, and next and previous link each orb to the others in its cell, so the grid is one
+// int per cell and two per orb however many cells a large box needs
+// reach is the radius of the largest orb, so that anything touching a point is in the cells within reach of it, and
+// speed is the fastest an orb can move, so that anything a moving point passes is found within a tick's travel more
 
-class gameState {
-    public:
-        time_t start_time;
-        float player_x;
-        float player_y;
-        float player_z;
-        bool accelerating;
-        bool turning_left;
-        bool turning_right;
-        bool turning_up;
-        bool turning_down;
-        point forward_belief;
-        point right_belief;
-        point up_belief;
+struct spatial_grid {
+    point low;
+    point high;
+    float reach;
+    float speed;
+    int cells_per_axis;
+    float cell_size;
+    float inverse_cell_size;
+    int *first;
+    int *next;
+    int *previous;
+};
 
-        // Places text in a char array to the top left or top right of the screen
+// Allocates a grid over the world's box for all of its orbs, with no orbs in it
+// Cells are grid_cell_size across unless that would need more than grid_max_cells_per_axis along the longest side
 
-        void drop_text(bool left, char* buffer, SDL_Color* colour, SDL_Renderer* renderer, TTF_Font* font, int w) {
-            SDL_Surface *surfaceMessage = TTF_RenderText_Solid(font, buffer, *colour);
-            SDL_Texture *Message = SDL_CreateTextureFromSurface(renderer, surfaceMessage);
-            SDL_Rect Message_rect = {left ? 0 : w - surfaceMessage->w, 0, surfaceMessage->w, surfaceMessage->h};
-            SDL_RenderCopy(renderer, Message, NULL, &Message_rect);
-            SDL_FreeSurface(surfaceMessage);
-            SDL_DestroyTexture(Message);
-        };
+void allocate_grid(spatial_grid *grid, scenario *world) {
+    grid->low = world->low;
+    grid->high = world->high;
+    grid->reach = world->max_radius;
+    grid->speed = world->max_velocity;
+    float extent = fmax(fmax(world->high.x - world->low.x, world->high.y - world->low.y), world->high.z - world->low.z);
+    grid->cell_size = fmax(grid_cell_size, extent / grid_max_cells_per_axis);
+    grid->inverse_cell_size = 1.0f / grid->cell_size;
+    grid->cells_per_axis = static_cast<int>(ceil(extent / grid->cell_size));
+    int cells = grid->cells_per_axis * grid->cells_per_axis * grid->cells_per_axis;
+    grid->first = new int[cells];
+    std::fill(grid->first, grid->first + cells, -1);
+    grid->next = new int[world->max_objects];
+    grid->previous = new int[world->max_objects];
+};
 
-        // Renders everything for a frame
+// Frees the arrays of a grid
 
-        void render(SDL_Renderer* renderer, SDL_Window* window, TTF_Font* font, SDL_Color* colour) {
-            SDL_RenderClear(renderer);
-            int h;
-            int w;
-            SDL_GetWindowSize(window, &w, &h);
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            index_distance order[object_count];
-            for (int i = 0; i < object_count; i++) {
-                float distance = sqrt((player_x - objects[i].centre.x) * (player_x - objects[i].centre.x) +
-                    (player_y - objects[i].centre.y) * (player_y - objects[i].centre.y) +
-                    (player_z - objects[i].centre.z) * (player_z - objects[i].centre.z));
-                order[i] = {
-                    index: i,
-                    distance: distance
-                };
-            };
-            index_sort(0, object_count, &order[0]);
-            for (int i = 0; i < object_count; i++) {
-                render_object(&objects[order[i].index], h, w, renderer, player_x, player_y, player_z, &forward_belief, &right_belief, &up_belief);
-            };
-            char buffer[64];
-            snprintf(buffer, 64, "x: %f | y: %f | z: %f", player_x, player_y, player_z);
-            drop_text(true, &buffer[0], colour, renderer, font, w);
-            snprintf(buffer, 64, "Seconds alive: %li", time(NULL) - start_time);
-            drop_text(false, &buffer[0], colour, renderer, font, w);
-            SDL_RenderPresent(renderer);
-        };
+void free_grid(spatial_grid *grid) {
+    delete[] grid->first;
+    delete[] grid->next;
+    delete[] grid->previous;
+};
 
-        // Updates the physics of everything between frames
+// Removes every orb from the grid
 
-        void update(bool *game_over) {
-            if (accelerating) {
-                player_velocity += forward_thruster_power * static_cast<float>(millisecond_frame_delay) / 1000.0f;
-            } else {
-                player_velocity = player_velocity * (1 - deceleration_rate * static_cast<float>(millisecond_frame_delay) / 1000.0f);
-            };
-            float sin_diff = sin(angular_change);
-            float cos_diff = cos(angular_change);
-            if (turning_left != turning_right) {
-                point temp_right = {
-                    x : right_belief.x,
-                    y : right_belief.y,
-                    z : right_belief.z
-                };
-                right_belief = {
-                    x : cos_diff * right_belief.x + sin_diff * (turning_left - turning_right) * forward_belief.x,
-                    y : cos_diff * right_belief.y + sin_diff * (turning_left - turning_right) * forward_belief.y,
-                    z : cos_diff * right_belief.z + sin_diff * (turning_left - turning_right) * forward_belief.z
-                };
-                forward_belief = {
-                    x : cos_diff * forward_belief.x + sin_diff * (turning_right - turning_left) * temp_right.x,
-                    y : cos_diff * forward_belief.y + sin_diff * (turning_right - turning_left) * temp_right.y,
-                    z : cos_diff * forward_belief.z + sin_diff * (turning_right - turning_left) * temp_right.z
-                };
-                normalise(&right_belief);
-                normalise(&forward_belief);
-            };
-            if (turning_down != turning_up) {
-                point temp_up = {
-                    x : up_belief.x,
-                    y : up_belief.y,
-                    z : up_belief.z
-                };
-                up_belief = {
-                    x : cos_diff * up_belief.x + sin_diff * (turning_up - turning_down) * forward_belief.x,
-                    y : cos_diff * up_belief.y + sin_diff * (turning_up - turning_down) * forward_belief.y,
-                    z : cos_diff * up_belief.z + sin_diff * (turning_up - turning_down) * forward_belief.z
-                };
-                forward_belief = {
-                    x : cos_diff * forward_belief.x + sin_diff * (turning_down - turning_up) * temp_up.x,
-                    y : cos_diff * forward_belief.y + sin_diff * (turning_down - turning_up) * temp_up.y,
-                    z : cos_diff * forward_belief.z + sin_diff * (turning_down - turning_up) * temp_up.z
-                };
-                normalise(&up_belief);
-                normalise(&forward_belief);
-            };
-            player_x += player_velocity * forward_belief.x * static_cast<float>(millisecond_frame_delay) / 1000.0f;
-            player_y += player_velocity * forward_belief.y * static_cast<float>(millisecond_frame_delay) / 1000.0f;
-            player_z += player_velocity * forward_belief.z * static_cast<float>(millisecond_frame_delay) / 1000.0f;
-            if (!ignore_losing && out_of_bounds(player_x, player_y, player_z, 0)) {
-                *game_over = true;
-                std::cout << "Game lost: player out of bounds\n";
-            };
-            if (object_count < scenario_max_objects) {
-                create_object(&objects[object_count]);
-                object_count++;
-            };
-            for (int i = 0; i < object_count; i++) {
-                movement_charcteristics object_movement = {
-                    azimuth : objects[i].azimuth,
-                    inclination : objects[i].inclination,
-                    velocity : objects[i].velocity * static_cast<float>(millisecond_frame_delay) / 1000.0f
-                };
-                point motion = to_cartesian(&object_movement);
-                objects[i].centre.x += motion.x;
-                objects[i].centre.y += motion.y;
-                objects[i].centre.z += motion.z;
-                if (out_of_bounds(objects[i].centre.x, objects[i].centre.y, objects[i].centre.z, objects[i].radius)) {
-                    create_object(&objects[i]); // Automatically overwrites the old one
-                };
-                if (sqrt((player_x - objects[i].centre.x) * (player_x - objects[i].centre.x) +
-                        (player_y - objects[i].centre.y) * (player_y - objects[i].centre.y) +
-                        (player_z - objects[i].centre.z) * (player_z - objects[i].centre.z)) < objects[i].radius) {
-                    *game_over = true;
-                    std::cout << "Game lost: impacted flying orb\n";
-                };
-            };
+void clear_grid(spatial_grid *grid) {
+    std::fill(grid->first, grid->first + grid->cells_per_axis * grid->cells_per_axis * grid->cells_per_axis, -1);
+};
+
+// Returns the cell coordinate along one axis for a position, clamped to the grid
+
+int grid_coordinate(spatial_grid *grid, float position, float low) {
+    int coordinate = static_cast<int>((position - low) * grid->inverse_cell_size);
+    return coordinate < 0 ? 0 : coordinate >= grid->cells_per_axis ? grid->cells_per_axis - 1 : coordinate;
+};
+
+// Returns the index of the cell a position is in
+
+int grid_cell(spatial_grid *grid, float x, float y, float z) {
+    return (grid_coordinate(grid, x, grid->low.x) * grid->cells_per_axis + grid_coordinate(grid, y, grid->low.y)) * grid->cells_per_axis +
+           grid_coordinate(grid, z, grid->low.z);
+};
+
+// Moves orbs [from, end) forward by seconds, one orb at a time, adding to lists that begin at position start
+// Used for the tail the vector kernels do not cover and on targets without SSE
+
+void integrate_orbs_scalar(orb_storage *orbs, int start, int from, int end, float seconds, spatial_grid *grid, int *respawn_count, int *moved_count) {
+    for (int i = from; i < end; i++) {
+        orbs->x[i] += orbs->velocity_x[i] * seconds;
+        orbs->y[i] += orbs->velocity_y[i] * seconds;
+        orbs->z[i] += orbs->velocity_z[i] * seconds;
+        if (out_of_bounds(&grid->low, &grid->high, orbs->x[i], orbs->y[i], orbs->z[i], orbs->radius[i])) {
+            orbs->respawn[start + (*respawn_count)++] = i;
         };
+        if (grid_cell(grid, orbs->x[i], orbs->y[i], orbs->z[i]) != orbs->cell[i]) {
+            orbs->moved[start + (*moved_count)++] = i;
+        };
+    };
+};
 
-        // Initialises variables before a new game
+// Moves orbs [start, end) forward by seconds, where start is a multiple of orb_lane_width. Orbs that left the boundary
+// are listed in orbs->respawn and orbs that crossed into another grid cell in orbs->moved, both in index order from
+// position start of each list, so separate ranges can be integrated at once. Returns the number listed in orbs->respawn
+
+int integrate_orbs(orb_storage *orbs, int start, int end, float seconds, spatial_grid *grid, int *moved_count) {
+    int respawn_count = 0;
+    *moved_count = 0;
+    int i = start;
+#if defined(__AVX__)
+    const __m256 step = _mm256_set1_ps(seconds);
+    const __m256 low_x = _mm256_set1_ps(grid->low.x), high_x = _mm256_set1_ps(grid->high.x);
+    const __m256 low_y = _mm256_set1_ps(grid->low.y), high_y = _mm256_set1_ps(grid->high.y);
+    const __m256 low_z = _mm256_set1_ps(grid->low.z), high_z = _mm256_set1_ps(grid->high.z);
+    const __m256 inverse_cell = _mm256_set1_ps(grid->inverse_cell_size);
+    const __m256 last_cell = _mm256_set1_ps(grid->cells_per_axis - 1);
+    const __m256 cells_per_axis = _mm256_set1_ps(grid->cells_per_axis);
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_load_ps(orbs->x + i), _mm256_mul_ps(_mm256_load_ps(orbs->velocity_x + i), step));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(orbs->y + i), _mm256_mul_ps(_mm256_load_ps(orbs->velocity_y + i), step));
+        __m256 z = _mm256_add_ps(_mm256_load_ps(orbs->z + i), _mm256_mul_ps(_mm256_load_ps(orbs->velocity_z + i), step));
+        _mm256_store_ps(orbs->x + i, x);
+        _mm256_store_ps(orbs->y + i, y);
+        _mm256_store_ps(orbs->z + i, z);
+        __m256 radius = _mm256_load_ps(orbs->radius + i);
+        __m256 outside = _mm256_or_ps(
+            _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(x, _mm256_add_ps(high_x, radius), _CMP_GT_OQ), _mm256_cmp_ps(x, _mm256_sub_ps(low_x, radius), _CMP_LT_OQ)),
+                         _mm256_or_ps(_mm256_cmp_ps(y, _mm256_add_ps(high_y, radius), _CMP_GT_OQ), _mm256_cmp_ps(y, _mm256_sub_ps(low_y, radius), _CMP_LT_OQ))),
+            _mm256_or_ps(_mm256_cmp_ps(z, _mm256_add_ps(high_z, radius), _CMP_GT_OQ), _mm256_cmp_ps(z, _mm256_sub_ps(low_z, radius), _CMP_LT_OQ)));
+        int mask = _mm256_movemask_ps(outside);
+        while (mask) {
+            orbs->respawn[start + respawn_count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        };
+        // Cell coordinates are clamped and truncated, then combined in float where they are exact for any sensible grid size
+        __m256 cell_x = _mm256_round_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(x, low_x), inverse_cell), zero), last_cell), _MM_FROUND_TO_ZERO);
+        __m256 cell_y = _mm256_round_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(y, low_y), inverse_cell), zero), last_cell), _MM_FROUND_TO_ZERO);
+        __m256 cell_z = _mm256_round_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(z, low_z), inverse_cell), zero), last_cell), _MM_FROUND_TO_ZERO);
+        __m256 cell = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(cell_x, cells_per_axis), cell_y), cells_per_axis), cell_z);
+        __m256 filed = _mm256_cvtepi32_ps(_mm256_load_si256(reinterpret_cast<__m256i *>(orbs->cell + i)));
+        mask = _mm256_movemask_ps(_mm256_cmp_ps(cell, filed, _CMP_NEQ_UQ));
+        while (mask) {
+            orbs->moved[start + (*moved_count)++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        };
+    };
+#elif defined(__SSE2__)
+    const __m128 step = _mm_set1_ps(seconds);
+    const __m128 low_x = _mm_set1_ps(grid->low.x), high_x = _mm_set1_ps(grid->high.x);
+    const __m128 low_y = _mm_set1_ps(grid->low.y), high_y = _mm_set1_ps(grid->high.y);
+    const __m128 low_z = _mm_set1_ps(grid->low.z), high_z = _mm_set1_ps(grid->high.z);
+    const __m128 inverse_cell = _mm_set1_ps(grid->inverse_cell_size);
+    const __m128 last_cell = _mm_set1_ps(grid->cells_per_axis - 1);
+    const __m128 cells_per_axis = _mm_set1_ps(grid->cells_per_axis);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_add_ps(_mm_load_ps(orbs->x + i), _mm_mul_ps(_mm_load_ps(orbs->velocity_x + i), step));
+        __m128 y = _mm_add_ps(_mm_load_ps(orbs->y + i), _mm_mul_ps(_mm_load_ps(orbs->velocity_y + i), step));
+        __m128 z = _mm_add_ps(_mm_load_ps(orbs->z + i), _mm_mul_ps(_mm_load_ps(orbs->velocity_z + i), step));
+        _mm_store_ps(orbs->x + i, x);
+        _mm_store_ps(orbs->y + i, y);
+        _mm_store_ps(orbs->z + i, z);
+        __m128 radius = _mm_load_ps(orbs->radius + i);
+        __m128 outside = _mm_or_ps(
+            _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(x, _mm_add_ps(high_x, radius)), _mm_cmplt_ps(x, _mm_sub_ps(low_x, radius))),
+                      _mm_or_ps(_mm_cmpgt_ps(y, _mm_add_ps(high_y, radius)), _mm_cmplt_ps(y, _mm_sub_ps(low_y, radius)))),
+            _mm_or_ps(_mm_cmpgt_ps(z, _mm_add_ps(high_z, radius)), _mm_cmplt_ps(z, _mm_sub_ps(low_z, radius))));
+        int mask = _mm_movemask_ps(outside);
+        while (mask) {
+            orbs->respawn[start + respawn_count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        };
+        // Cell coordinates are clamped then truncated to integers, and combined back in float where they are exact
+        __m128 cell_x = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(x, low_x), inverse_cell), zero), last_cell)));
+        __m128 cell_y = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(y, low_y), inverse_cell), zero), last_cell)));
+        __m128 cell_z = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(z, low_z), inverse_cell), zero), last_cell)));
+        __m128 cell = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(cell_x, cells_per_axis), cell_y), cells_per_axis), cell_z);
+        __m128 filed = _mm_cvtepi32_ps(_mm_load_si128(reinterpret_cast<__m128i *>(orbs->cell + i)));
+        mask = _mm_movemask_ps(_mm_cmpneq_ps(cell, filed));
+        while (mask) {
+            orbs->moved[start + (*moved_count)++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        };
+    };
+#endif
+    integrate_orbs_scalar(orbs, start, i, end, seconds, grid, &respawn_count, moved_count);
+    return respawn_count;
+};
+
+// Refiles orbs whose cell may have changed, either listed by integrate_orbs or freshly spawned
+// Listing an orb that has not actually changed cell is harmless
+
+void update_grid(spatial_grid *grid, orb_storage *orbs, int *listed, int count) {
+    for (int j = 0; j < count; j++) {
+        int i = listed[j];
+        int cell = grid_cell(grid, orbs->x[i], orbs->y[i], orbs->z[i]);
+        int old_cell = orbs->cell[i];
+        if (cell == old_cell) {
+            continue;
+        };
+        if (old_cell >= 0) {
+            int before = grid->previous[i];
+            int after = grid->next[i];
+            if (before >= 0) {
+                grid->next[before] = after;
+            } else {
+                grid->first[old_cell] = after;
+            };
+            if (after >= 0) {
+                grid->previous[after] = before;
+            };
+        };
+        orbs->cell[i] = cell;
+        int after = grid->first[cell];
+        grid->previous[i] = -1;
+        grid->next[i] = after;
+        if (after >= 0) {
+            grid->previous[after] = i;
+        };
+        grid->first[cell] = i;
+    };
+};
+
+// Returns the earliest fraction of a tick at which a sphere of radius reach, moving in a straight line from start by
+// motion, touches orb i as it moves by its velocity over seconds to where it is now, or -1 if they stay apart
+// Their separation squared is a quadratic in the fraction, so the time of impact is its smaller root
+
+float sweep_orb(orb_storage *orbs, int i, point *start, point *motion, float reach, float seconds) {
+    float dx = start->x - (orbs->x[i] - orbs->velocity_x[i] * seconds);
+    float dy = start->y - (orbs->y[i] - orbs->velocity_y[i] * seconds);
+    float dz = start->z - (orbs->z[i] - orbs->velocity_z[i] * seconds);
+    float touching = orbs->radius[i] + reach;
+    float apart = dx * dx + dy * dy + dz * dz - touching * touching;
+    if (apart < 0) {
+        return 0;
+    };
+    float wx = motion->x - orbs->velocity_x[i] * seconds;
+    float wy = motion->y - orbs->velocity_y[i] * seconds;
+    float wz = motion->z - orbs->velocity_z[i] * seconds;
+    float closing = dx * wx + dy * wy + dz * wz;
+    if (closing >= 0) {
+        return -1;
+    };
+    float speed = wx * wx + wy * wy + wz * wz;
+    float discriminant = closing * closing - speed * apart;
+    if (discriminant <= 0) {
+        return -1;
+    };
+    float impact = (-closing - sqrt(discriminant)) / speed;
+    return impact < 1 ? impact : -1;
+};
+
+// Returns the earliest fraction of a tick at which the player, a sphere of radius reach moving from start by motion,
+// touches any orb during a tick of seconds, or -1 if it touches none. Only the cells around the player's path are
+// checked, widened by the largest orb and the furthest an orb can move in the tick
+
+float grid_sweep_player(spatial_grid *grid, orb_storage *orbs, point *start, point *motion, float reach, float seconds) {
+    float margin = grid->reach + reach + grid->speed * seconds;
+    int low_x = grid_coordinate(grid, fmin(start->x, start->x + motion->x) - margin, grid->low.x);
+    int high_x = grid_coordinate(grid, fmax(start->x, start->x + motion->x) + margin, grid->low.x);
+    int low_y = grid_coordinate(grid, fmin(start->y, start->y + motion->y) - margin, grid->low.y);
+    int high_y = grid_coordinate(grid, fmax(start->y, start->y + motion->y) + margin, grid->low.y);
+    int low_z = grid_coordinate(grid, fmin(start->z, start->z + motion->z) - margin, grid->low.z);
+    int high_z = grid_coordinate(grid, fmax(start->z, start->z + motion->z) + margin, grid->low.z);
+    float earliest = -1;
+    for (int cx = low_x; cx <= high_x; cx++) {
+        for (int cy = low_y; cy <= high_y; cy++) {
+            for (int cz = low_z; cz <= high_z; cz++) {
+                for (int i = grid->first[(cx * grid->cells_per_axis + cy) * grid->cells_per_axis + cz]; i >= 0; i = grid->next[i]) {
+                    float impact = sweep_orb(orbs, i, start, motion, reach, seconds);
+                    if (impact >= 0 && (earliest < 0 || impact < earliest)) {
+                        earliest = impact;
+                    };
+                };
+            };
+        };
+    };
+    return earliest;
+};
+
+// Returns the fraction of a tick at which a sphere of radius reach, moving from start inside the box by motion, first
+// touches one of its walls, or -1 if it stays inside
+
+float sweep_walls(point *low, point *high, point *start, point *motion, float reach) {
+    float from[3] = {start->x, start->y, start->z};
+    float by[3] = {motion->x, motion->y, motion->z};
+    float lows[3] = {low->x + reach, low->y + reach, low->z + reach};
+    float highs[3] = {high->x - reach, high->y - reach, high->z - reach};
+    float earliest = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        float to = from[axis] + by[axis];
+        float impact = to > highs[axis] ? (highs[axis] - from[axis]) / by[axis] : to < lows[axis] ? (lows[axis] - from[axis]) / by[axis] : -1;
+        if (impact >= 0 && (earliest < 0 || impact < earliest)) {
+            earliest = impact;
+        };
+    };
+    return earliest;
+};
+
+// Persistent sweep and prune over every orb, for orbs bouncing off each other
+// Orbs are kept in one list sorted by the y-z band their centre is in and then by the low end of their span along x.
+// Bands are at least as wide as the largest pair of orbs, so touching orbs are always in the same or neighbouring bands,
+// and sorting along x within a band keeps the sweep linear however many bands there are, where a single axis over a
+// whole 3D box would find ever more overlapping spans as orbs are added
+// Orbs move very little each tick, so the list is re-sorted by insertion from the last tick's order in close to linear
+// time. Orbs that respawned or were just added jump anywhere, so they are sorted apart and merged back in
+// x, y, z and radius are copies in list order so the sweep reads memory in sequence. contacts holds each band's touching
+// pairs as orb indices, kept between ticks so their memory is reused
+
+struct sweep_prune {
+    float band_size;
+    int bands_per_axis;
+    point low;
+    double stride;
+    std::vector<int> order;
+    std::vector<int> fresh;
+    std::vector<int> merged;
+    std::vector<unsigned char> respawned;
+    std::vector<double> key;
+    std::vector<int> band_start;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+    std::vector<std::vector<int>> contacts;
+};
+
+// Sets up an empty sweep and prune for the world's box and orbs
+
+void allocate_sweep(sweep_prune *sweep, scenario *world) {
+    float extent = fmax(world->high.y - world->low.y, world->high.z - world->low.z);
+    sweep->band_size = fmax(2.0f * world->max_radius, extent / grid_max_cells_per_axis);
+    sweep->bands_per_axis = max(static_cast<int>(ceil(extent / sweep->band_size)), 1);
+    sweep->low = world->low;
+    sweep->stride = (world->high.x - world->low.x) + 8.0 * sweep->band_size;
+    sweep->order.clear();
+    sweep->respawned.assign(world->max_objects, 0);
+    sweep->key.resize(world->max_objects);
+    sweep->band_start.resize(sweep->bands_per_axis * sweep->bands_per_axis + 1);
+    sweep->contacts.assign(sweep->bands_per_axis * sweep->bands_per_axis, std::vector<int>());
+};
+
+// Returns the band an orb centred at y, z is in, clamped to the box
+
+int sweep_band(sweep_prune *sweep, float y, float z) {
+    int by = static_cast<int>((y - sweep->low.y) / sweep->band_size);
+    int bz = static_cast<int>((z - sweep->low.z) / sweep->band_size);
+    by = by < 0 ? 0 : by >= sweep->bands_per_axis ? sweep->bands_per_axis - 1 : by;
+    bz = bz < 0 ? 0 : bz >= sweep->bands_per_axis ? sweep->bands_per_axis - 1 : bz;
+    return by * sweep->bands_per_axis + bz;
+};
+
+// Returns true if orb a comes before orb b in the list. Ties go to the lower index, so the order is the same however it
+// was reached
+
+bool sweep_before(sweep_prune *sweep, int a, int b) {
+    return sweep->key[a] < sweep->key[b] || (sweep->key[a] == sweep->key[b] && a < b);
+};
+
+// Brings the list up to date with the first count orbs after they have moved, given the respawned orbs listed in
+// respawned. Orbs after the end of the list are new and are added to it
+
+void sort_sweep(sweep_prune *sweep, orb_storage *orbs, int count, int *respawned, int respawn_count) {
+    // Each band's keys sit in their own stretch of stride, which has room for orbs a little outside the box
+    for (int i = 0; i < count; i++) {
+        sweep->key[i] = sweep_band(sweep, orbs->y[i], orbs->z[i]) * sweep->stride +
+                        (orbs->x[i] - orbs->radius[i] - sweep->low.x + 4.0 * sweep->band_size);
+    };
+    sweep->fresh.clear();
+    for (int j = 0; j < respawn_count; j++) {
+        if (respawned[j] < static_cast<int>(sweep->order.size())) {
+            sweep->respawned[respawned[j]] = 1;
+            sweep->fresh.push_back(respawned[j]);
+        };
+    };
+    for (int i = sweep->order.size(); i < count; i++) {
+        sweep->fresh.push_back(i);
+    };
+    int kept = 0;
+    for (int index : sweep->order) {
+        if (sweep->respawned[index]) {
+            sweep->respawned[index] = 0;
+        } else {
+            sweep->order[kept++] = index;
+        };
+    };
+    sweep->order.resize(kept);
+    for (int i = 1; i < kept; i++) {
+        int index = sweep->order[i];
+        int j = i;
+        while (j > 0 && sweep_before(sweep, index, sweep->order[j - 1])) {
+            sweep->order[j] = sweep->order[j - 1];
+            j--;
+        };
+        sweep->order[j] = index;
+    };
+    std::sort(sweep->fresh.begin(), sweep->fresh.end(), [sweep](int a, int b) { return sweep_before(sweep, a, b); });
+    sweep->merged.resize(count);
+    std::merge(sweep->order.begin(), sweep->order.end(), sweep->fresh.begin(), sweep->fresh.end(), sweep->merged.begin(),
+               [sweep](int a, int b) { return sweep_before(sweep, a, b); });
+    sweep->order.swap(sweep->merged);
+    std::vector<float> *copies[] = {&sweep->x, &sweep->y, &sweep->z, &sweep->radius};
+    float *sources[] = {orbs->x, orbs->y, orbs->z, orbs->radius};
+    for (int f = 0; f < 4; f++) {
+        copies[f]->resize(count);
+        float *to = copies[f]->data();
+        for (int p = 0; p < count; p++) {
+            to[p] = sources[f][sweep->order[p]];
+        };
+    };
+    int bands = sweep->bands_per_axis * sweep->bands_per_axis;
+    int position = 0;
+    for (int band = 0; band <= bands; band++) {
+        while (position < count && sweep_band(sweep, sweep->y[position], sweep->z[position]) < band) {
+            position++;
+        };
+        sweep->band_start[band] = position;
+    };
+};
+
+// Adds list positions p and q to band's contacts if the orbs there overlap and are moving towards each other
+
+void sweep_pair(sweep_prune *sweep, orb_storage *orbs, int band, int p, int q) {
+    float dx = sweep->x[q] - sweep->x[p];
+    float dy = sweep->y[q] - sweep->y[p];
+    float dz = sweep->z[q] - sweep->z[p];
+    float touching = sweep->radius[p] + sweep->radius[q];
+    if (dx * dx + dy * dy + dz * dz >= touching * touching) {
+        return;
+    };
+    int a = sweep->order[p];
+    int b = sweep->order[q];
+    float closing = (orbs->velocity_x[a] - orbs->velocity_x[b]) * dx + (orbs->velocity_y[a] - orbs->velocity_y[b]) * dy +
+                    (orbs->velocity_z[a] - orbs->velocity_z[b]) * dz;
+    if (closing > 0) {
+        sweep->contacts[band].push_back(a);
+        sweep->contacts[band].push_back(b);
+    };
+};
+
+// Lists the approaching pairs of touching orbs with one in each of bands [start, end), pairing each band with itself and
+// the four neighbours after it so that every pair is found exactly once
+
+void sweep_bands(sweep_prune *sweep, orb_storage *orbs, int start, int end) {
+    const int neighbours[4][2] = {{0, 1}, {1, -1}, {1, 0}, {1, 1}};
+    float widest = 2.0f * sweep->band_size;
+    for (int band = start; band < end; band++) {
+        sweep->contacts[band].clear();
+        int first = sweep->band_start[band];
+        int last = sweep->band_start[band + 1];
+        for (int p = first; p < last; p++) {
+            float high = sweep->x[p] + sweep->radius[p];
+            for (int q = p + 1; q < last && sweep->x[q] - sweep->radius[q] <= high; q++) {
+                sweep_pair(sweep, orbs, band, p, q);
+            };
+        };
+        int by = band / sweep->bands_per_axis;
+        int bz = band % sweep->bands_per_axis;
+        for (const int *step : neighbours) {
+            int ny = by + step[0];
+            int nz = bz + step[1];
+            if (ny >= sweep->bands_per_axis || nz < 0 || nz >= sweep->bands_per_axis) {
+                continue;
+            };
+            int other = ny * sweep->bands_per_axis + nz;
+            int from = sweep->band_start[other];
+            int to = sweep->band_start[other + 1];
+            for (int p = first; p < last; p++) {
+                float low = sweep->x[p] - sweep->radius[p];
+                float high = sweep->x[p] + sweep->radius[p];
+                while (from < to && sweep->x[from] - sweep->radius[from] < low - widest) {
+                    from++;
+                };
+                for (int q = from; q < to && sweep->x[q] - sweep->radius[q] <= high; q++) {
+                    sweep_pair(sweep, orbs, band, p, q);
+                };
+            };
+        };
+    };
+};
+
+// Bounces two touching orbs a and b off each other if they are still approaching
+// Their new directions come from the impulse of an elastic collision between masses that go with the cube of their
+// radius, and each then keeps its own speed, so orbs never leave the scenario's speed range
+
+void bounce_orbs(orb_storage *orbs, int a, int b) {
+    float nx = orbs->x[b] - orbs->x[a];
+    float ny = orbs->y[b] - orbs->y[a];
+    float nz = orbs->z[b] - orbs->z[a];
+    float length = sqrt(nx * nx + ny * ny + nz * nz);
+    if (length == 0) {
+        return;
+    };
+    nx /= length;
+    ny /= length;
+    nz /= length;
+    float closing = (orbs->velocity_x[a] - orbs->velocity_x[b]) * nx + (orbs->velocity_y[a] - orbs->velocity_y[b]) * ny +
+                    (orbs->velocity_z[a] - orbs->velocity_z[b]) * nz;
+    if (closing <= 0) {
+        return;
+    };
+    float mass_a = orbs->radius[a] * orbs->radius[a] * orbs->radius[a];
+    float mass_b = orbs->radius[b] * orbs->radius[b] * orbs->radius[b];
+    float impulse = 2.0f * closing / (1.0f / mass_a + 1.0f / mass_b);
+    int sides[2] = {a, b};
+    float pushes[2] = {-impulse / mass_a, impulse / mass_b};
+    for (int s = 0; s < 2; s++) {
+        int i = sides[s];
+        float speed = sqrt(orbs->velocity_x[i] * orbs->velocity_x[i] + orbs->velocity_y[i] * orbs->velocity_y[i] +
+                           orbs->velocity_z[i] * orbs->velocity_z[i]);
+        float vx = orbs->velocity_x[i] + pushes[s] * nx;
+        float vy = orbs->velocity_y[i] + pushes[s] * ny;
+        float vz = orbs->velocity_z[i] + pushes[s] * nz;
+        float bounced = sqrt(vx * vx + vy * vy + vz * vz);
+        if (bounced > 0) {
+            orbs->velocity_x[i] = vx * speed / bounced;
+            orbs->velocity_y[i] = vy * speed / bounced;
+            orbs->velocity_z[i] = vz * speed / bounced;
+        };
+    };
+};
+
+// Determines if a sphere could be seen from the player, i.e. it is within the cone of view_max_angle around forward
+
+bool sphere_in_view(point *player, point *forward, float x, float y, float z, float radius) {
+    float dx = x - player->x;
+    float dy = y - player->y;
+    float dz = z - player->z;
+    float along = dx * forward->x + dy * forward->y + dz * forward->z;
+    float squared = dx * dx + dy * dy + dz * dz;
+    float across = sqrt(fmax(squared - along * along, 0.0f));
+    return across * cos(view_max_angle) - along * sin(view_max_angle) <= radius;
+};
+
+// Lists the orbs in cells that overlap the view cone, testing blocks of cells first so distant regions are skipped quickly
+
+void grid_query_view(spatial_grid *grid, point *player, point *forward, std::vector<int> *out) {
+    out->clear();
+    int block = grid_view_block;
+    int n = grid->cells_per_axis;
+    float cell_reach = grid->cell_size * 0.5f * sqrt(3.0f) + grid->reach;
+    for (int bx = 0; bx < n; bx += block) {
+        for (int by = 0; by < n; by += block) {
+            for (int bz = 0; bz < n; bz += block) {
+                float half = grid->cell_size * block * 0.5f;
+                if (!sphere_in_view(player, forward, grid->low.x + bx * grid->cell_size + half, grid->low.y + by * grid->cell_size + half,
+                                    grid->low.z + bz * grid->cell_size + half, half * sqrt(3.0f) + grid->reach)) {
+                    continue;
+                };
+                for (int cx = bx; cx < min(bx + block, n); cx++) {
+                    for (int cy = by; cy < min(by + block, n); cy++) {
+                        for (int cz = bz; cz < min(bz + block, n); cz++) {
+                            int cell = grid->first[(cx * n + cy) * n + cz];
+                            if (cell < 0 || !sphere_in_view(player, forward, grid->low.x + (cx + 0.5f) * grid->cell_size,
+                                                                grid->low.y + (cy + 0.5f) * grid->cell_size,
+                                                                grid->low.z + (cz + 0.5f) * grid->cell_size, cell_reach)) {
+                                continue;
+                            };
+                            for (int i = cell; i >= 0; i = grid->next[i]) {
+                                out->push_back(i);
+                            };
+                        };
+                    };
+                };
+            };
+        };
+    };
+};
+
+// Converts a vector to unit length
+
+void normalise(point *a) {
+    float divisor = sqrt(a->x * a->x + a->y * a->y + a->z * a->z);
+    a->x = a->x / divisor;
+    a->y = a->y / divisor;
+    a->z = a->z / divisor;
+};
+
+// Turns a basis by angle, yawing towards right if yaw is positive or away from it if negative, then pitching towards
+// up if pitch is negative or away from it if positive. Frames use it to turn the view on ahead of the simulation
+
+void turn_basis(point *forward, point *right, point *up, int yaw, int pitch, float angle) {
+    float sin_diff = sin(angle);
+    float cos_diff = cos(angle);
+    if (yaw != 0) {
+        point temp_right = *right;
+        *right = {
+            x : cos_diff * right->x + sin_diff * -yaw * forward->x,
+            y : cos_diff * right->y + sin_diff * -yaw * forward->y,
+            z : cos_diff * right->z + sin_diff * -yaw * forward->z
+        };
+        *forward = {
+            x : cos_diff * forward->x + sin_diff * yaw * temp_right.x,
+            y : cos_diff * forward->y + sin_diff * yaw * temp_right.y,
+            z : cos_diff * forward->z + sin_diff * yaw * temp_right.z
+        };
+        normalise(right);
+        normalise(forward);
+    };
+    if (pitch != 0) {
+        point temp_up = *up;
+        *up = {
+            x : cos_diff * up->x + sin_diff * -pitch * forward->x,
+            y : cos_diff * up->y + sin_diff * -pitch * forward->y,
+            z : cos_diff * up->z + sin_diff * -pitch * forward->z
+        };
+        *forward = {
+            x : cos_diff * forward->x + sin_diff * pitch * temp_up.x,
+            y : cos_diff * forward->y + sin_diff * pitch * temp_up.y,
+            z : cos_diff * forward->z + sin_diff * pitch * temp_up.z
+        };
+        normalise(up);
+        normalise(forward);
+    };
+};
+
+// An orb as seen from the camera in a frame: where its centre lands on screen, its radius in pixels and its distance
+// Sorting, culling and drawing all work from an array of these
+
+struct view_orb {
+    int index;
+    float distance;
+    float x;
+    float y;
+    float radius;
+};
+
+// The camera for one frame: the inverse of the player's basis and the screen it projects onto
+// The adjoint is used as the inverse as the basis vectors are expected to always be orthonormal
+
+struct view_basis {
+    point position;
+    float adjoint[3][3];
+    float scale;
+    float w;
+    float h;
+    float half_w;
+    float half_h;
+};
+
+// Builds the camera for a frame from the player's position and basis vectors and the window size
+
+void build_view(view_basis *view, point *position, point *forward, point *right, point *up, int h, int w) {
+    view->position = *position;
+    float adjoint[3][3] = {{right->y * up->z - right->z * up->y,
+                            forward->z * up->y - forward->y * up->z,
+                            forward->y * right->z - forward->z * right->y},
+                           {right->z * up->x - right->x * up->z,
+                            forward->x * up->z - forward->z * up->x,
+                            forward->z * right->x - forward->x * right->z},
+                           {right->x * up->y - right->y * up->x,
+                            forward->y * up->x - forward->x * up->y,
+                            forward->x * right->y - forward->y * right->x}};
+    memcpy(view->adjoint, adjoint, sizeof(adjoint));
+    view->scale = static_cast<float>(max(h, w));
+    view->w = static_cast<float>(w);
+    view->h = static_cast<float>(h);
+    view->half_w = static_cast<float>(w / 2);
+    view->half_h = static_cast<float>(h / 2);
+};
+
+// Projects one orb already converted to camera space, adding it to out if it is in the view frustum
+// The frustum is the view_max_angle cone around forward, cut down to whatever part of it lands on the window
+
+void project_orb(view_basis *view, int index, float forward, float across, float upward, float radius, view_orb *out, int *count) {
+    if (forward <= 0 || sqrt(across * across + upward * upward) * cos(view_max_angle) - forward * sin(view_max_angle) > radius) {
+        return;
+    };
+    float distance = sqrt(forward * forward + across * across + upward * upward);
+    view_orb projected = {
+        index : index,
+        distance : distance,
+        x : view->scale * across / sqrt(forward * forward + upward * upward) + view->half_w,
+        y : view->scale * upward / sqrt(forward * forward + across * across) + view->half_h,
+        radius : view->scale * radius / distance
+    };
+    if (projected.x + projected.radius < 0 || projected.x - projected.radius > view->w ||
+        projected.y + projected.radius < 0 || projected.y - projected.radius > view->h) {
+        return;
+    };
+    out[(*count)++] = projected;
+};
+
+// Converts the listed orbs into camera space and projects those in the view frustum into out, four at a time
+// Orbs are drawn rewind seconds back along their path, which places them between the last two ticks as orbs move in straight lines
+// Returns the number written to out, which needs room for count entries
+
+int transform_orbs(view_basis *view, orb_storage *orbs, int *indices, int count, float rewind, view_orb *out) {
+    int written = 0;
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 position_x = _mm_set1_ps(view->position.x);
+    const __m128 position_y = _mm_set1_ps(view->position.y);
+    const __m128 position_z = _mm_set1_ps(view->position.z);
+    const __m128 back = _mm_set1_ps(rewind);
+    __m128 adjoint[3][3];
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++) {
+            adjoint[row][column] = _mm_set1_ps(view->adjoint[row][column]);
+        };
+    };
+    const __m128 scale = _mm_set1_ps(view->scale);
+    const __m128 half_w = _mm_set1_ps(view->half_w);
+    const __m128 half_h = _mm_set1_ps(view->half_h);
+    const __m128 screen_w = _mm_set1_ps(view->w);
+    const __m128 screen_h = _mm_set1_ps(view->h);
+    const __m128 cone_cos = _mm_set1_ps(cos(view_max_angle));
+    const __m128 cone_sin = _mm_set1_ps(sin(view_max_angle));
+    for (; i + 4 <= count; i += 4) {
+        int a = indices[i], b = indices[i + 1], c = indices[i + 2], d = indices[i + 3];
+        __m128 x = _mm_sub_ps(_mm_set_ps(orbs->x[d], orbs->x[c], orbs->x[b], orbs->x[a]), position_x);
+        __m128 y = _mm_sub_ps(_mm_set_ps(orbs->y[d], orbs->y[c], orbs->y[b], orbs->y[a]), position_y);
+        __m128 z = _mm_sub_ps(_mm_set_ps(orbs->z[d], orbs->z[c], orbs->z[b], orbs->z[a]), position_z);
+        x = _mm_sub_ps(x, _mm_mul_ps(_mm_set_ps(orbs->velocity_x[d], orbs->velocity_x[c], orbs->velocity_x[b], orbs->velocity_x[a]), back));
+        y = _mm_sub_ps(y, _mm_mul_ps(_mm_set_ps(orbs->velocity_y[d], orbs->velocity_y[c], orbs->velocity_y[b], orbs->velocity_y[a]), back));
+        z = _mm_sub_ps(z, _mm_mul_ps(_mm_set_ps(orbs->velocity_z[d], orbs->velocity_z[c], orbs->velocity_z[b], orbs->velocity_z[a]), back));
+        __m128 radius = _mm_set_ps(orbs->radius[d], orbs->radius[c], orbs->radius[b], orbs->radius[a]);
+        __m128 forward = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, adjoint[0][0]), _mm_mul_ps(y, adjoint[1][0])), _mm_mul_ps(z, adjoint[2][0]));
+        __m128 across = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, adjoint[0][1]), _mm_mul_ps(y, adjoint[1][1])), _mm_mul_ps(z, adjoint[2][1]));
+        __m128 upward = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, adjoint[0][2]), _mm_mul_ps(y, adjoint[1][2])), _mm_mul_ps(z, adjoint[2][2]));
+        __m128 forward_squared = _mm_mul_ps(forward, forward);
+        __m128 across_squared = _mm_mul_ps(across, across);
+        __m128 upward_squared = _mm_mul_ps(upward, upward);
+        __m128 off_axis = _mm_sqrt_ps(_mm_add_ps(across_squared, upward_squared));
+        __m128 in_cone = _mm_and_ps(_mm_cmpgt_ps(forward, _mm_setzero_ps()),
+                                    _mm_cmple_ps(_mm_sub_ps(_mm_mul_ps(off_axis, cone_cos), _mm_mul_ps(forward, cone_sin)), radius));
+        if (!_mm_movemask_ps(in_cone)) {
+            continue;
+        };
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(forward_squared, across_squared), upward_squared));
+        __m128 centre_x = _mm_add_ps(_mm_div_ps(_mm_mul_ps(scale, across), _mm_sqrt_ps(_mm_add_ps(forward_squared, upward_squared))), half_w);
+        __m128 centre_y = _mm_add_ps(_mm_div_ps(_mm_mul_ps(scale, upward), _mm_sqrt_ps(_mm_add_ps(forward_squared, across_squared))), half_h);
+        __m128 size = _mm_div_ps(_mm_mul_ps(scale, radius), length);
+        __m128 on_screen = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(centre_x, size), _mm_setzero_ps()), _mm_cmple_ps(_mm_sub_ps(centre_x, size), screen_w)),
+                                      _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(centre_y, size), _mm_setzero_ps()), _mm_cmple_ps(_mm_sub_ps(centre_y, size), screen_h)));
+        int in_front = _mm_movemask_ps(_mm_and_ps(in_cone, on_screen));
+        float distance[4], screen_x[4], screen_y[4], screen_radius[4];
+        _mm_storeu_ps(distance, length);
+        _mm_storeu_ps(screen_x, centre_x);
+        _mm_storeu_ps(screen_y, centre_y);
+        _mm_storeu_ps(screen_radius, size);
+        while (in_front) {
+            int lane = __builtin_ctz(in_front);
+            out[written++] = {
+                index : indices[i + lane],
+                distance : distance[lane],
+                x : screen_x[lane],
+                y : screen_y[lane],
+                radius : screen_radius[lane]
+            };
+            in_front &= in_front - 1;
+        };
+    };
+#endif
+    for (; i < count; i++) {
+        int index = indices[i];
+        float x = orbs->x[index] - orbs->velocity_x[index] * rewind - view->position.x;
+        float y = orbs->y[index] - orbs->velocity_y[index] * rewind - view->position.y;
+        float z = orbs->z[index] - orbs->velocity_z[index] * rewind - view->position.z;
+        project_orb(view, index,
+                    x * view->adjoint[0][0] + y * view->adjoint[1][0] + z * view->adjoint[2][0],
+                    x * view->adjoint[0][1] + y * view->adjoint[1][1] + z * view->adjoint[2][1],
+                    x * view->adjoint[0][2] + y * view->adjoint[1][2] + z * view->adjoint[2][2],
+                    orbs->radius[index], out, &written);
+    };
+    return written;
+};
+
+// Working space for putting each frame's visible orbs in drawing order, kept between frames so sorting never allocates once warm
+
+struct draw_order {
+    std::vector<unsigned long long> keys;
+    std::vector<unsigned long long> sorted;
+    std::vector<view_orb> scratch;
+};
+
+// Returns true if a should be drawn before b
+
+bool further(const view_orb &a, const view_orb &b) {
+    return a.distance > b.distance;
+};
+
+// Sorts this frame's visible orbs furthest first in place with a two pass radix sort on depth quantised to 16 bits
+// The 16 bits span from the eye to the furthest visible orb, so depth is resolved as finely in a huge box as a small one
+// Each key holds the quantised depth above the entry's position, so only the keys move until the end
+// Cost is linear in count whatever the previous order was, so respawned orbs or a sudden turn cost nothing extra
+
+void sort_draw_order(draw_order *draw, view_orb *entries, int count) {
+    const int digit_bits = 8;
+    const int buckets = 1 << digit_bits;
+    draw->keys.resize(count);
+    draw->sorted.resize(count);
+    unsigned long long *from = draw->keys.data();
+    unsigned long long *to = draw->sorted.data();
+    float furthest = 0;
+    for (int i = 0; i < count; i++) {
+        furthest = fmax(furthest, entries[i].distance);
+    };
+    float steps_per_unit = furthest > 0 ? 65535.0f / furthest : 0;
+    for (int i = 0; i < count; i++) {
+        float steps = fmin(entries[i].distance * steps_per_unit, 65535.0f);
+        from[i] = (static_cast<unsigned long long>(65535u - static_cast<unsigned int>(steps)) << 32) | static_cast<unsigned int>(i);
+    };
+    for (int shift = 32; shift < 48; shift += digit_bits) {
+        int offsets[buckets] = {};
+        for (int i = 0; i < count; i++) {
+            offsets[(from[i] >> shift) & (buckets - 1)]++;
+        };
+        int total = 0;
+        for (int b = 0; b < buckets; b++) {
+            int size = offsets[b];
+            offsets[b] = total;
+            total += size;
+        };
+        for (int i = 0; i < count; i++) {
+            to[offsets[(from[i] >> shift) & (buckets - 1)]++] = from[i];
+        };
+        unsigned long long *swap = from;
+        from = to;
+        to = swap;
+    };
+    draw->scratch.resize(count);
+    for (int i = 0; i < count; i++) {
+        draw->scratch[i] = entries[static_cast<unsigned int>(from[i])];
+    };
+    memcpy(entries, draw->scratch.data(), count * sizeof(view_orb));
+};
+
+// A chunk of a parallel loop, covering [start, end)
+
+struct work_chunk {
+    int start;
+    int end;
+};
+
+// Chunks waiting to run on one worker. The owner takes from the back and other workers steal from the front
+
+struct work_queue {
+    std::mutex lock;
+    std::deque<work_chunk> chunks;
+};
+
+// Pool of worker threads that split loops into chunks. Each worker has its own queue and steals from the others when
+// it runs dry, so chunks that take longer than others do not leave threads idle. The calling thread works as worker 0
+
+class thread_pool {
+    public:
+        int size;
+
+        thread_pool(int threads) {
+            size = threads < 1 ? 1 : threads;
+            queues = new work_queue[size];
+            remaining = 0;
+            generation = 0;
+            stopping = false;
+            for (int i = 1; i < size; i++) {
+                workers.emplace_back(&thread_pool::work, this, i);
+            };
+        };
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> guard(wake_lock);
+                stopping = true;
+            };
+            wake.notify_all();
+            for (std::thread &worker : workers) {
+                worker.join();
+            };
+            delete[] queues;
+        };
+
+        // Runs body over [0, count) in chunks of chunk, returning once every chunk has finished
+
+        void parallel_for(int count, int chunk, std::function<void(int, int)> body) {
+            if (size == 1 || count <= chunk) {
+                if (count > 0) {
+                    body(0, count);
+                };
+                return;
+            };
+            job = body;
+            int chunks = (count + chunk - 1) / chunk;
+            remaining = chunks;
+            for (int c = 0; c < chunks; c++) {
+                work_queue *queue = &queues[c % size];
+                std::lock_guard<std::mutex> guard(queue->lock);
+                queue->chunks.push_back({c * chunk, min((c + 1) * chunk, count)});
+            };
+            {
+                std::lock_guard<std::mutex> guard(wake_lock);
+                generation++;
+            };
+            wake.notify_all();
+            while (run_one(0)) {
+            };
+            while (remaining.load() > 0) {
+                std::this_thread::yield();
+            };
+        };
+
+    private:
+        work_queue *queues;
+        std::vector<std::thread> workers;
+        std::function<void(int, int)> job;
+        std::atomic<int> remaining;
+        std::mutex wake_lock;
+        std::condition_variable wake;
+        unsigned long long generation;
+        bool stopping;
+
+        // Runs one chunk as worker, from its own queue if it has one or else stolen from another. Returns false if none were left
+
+        bool run_one(int worker) {
+            work_chunk chunk;
+            bool found = false;
+            for (int i = 0; i < size && !found; i++) {
+                work_queue *queue = &queues[(worker + i) % size];
+                std::lock_guard<std::mutex> guard(queue->lock);
+                if (queue->chunks.empty()) {
+                    continue;
+                };
+                if (i == 0) {
+                    chunk = queue->chunks.back();
+                    queue->chunks.pop_back();
+                } else {
+                    chunk = queue->chunks.front();
+                    queue->chunks.pop_front();
+                };
+                found = true;
+            };
+            if (!found) {
+                return false;
+            };
+            job(chunk.start, chunk.end);
+            remaining--;
+            return true;
+        };
+
+        // Loop for the threads of the pool, sleeping between jobs
+
+        void work(int worker) {
+            unsigned long long seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> guard(wake_lock);
+                    wake.wait(guard, [&] { return stopping || generation != seen; });
+                    if (stopping) {
+                        return;
+                    };
+                    seen = generation;
+                };
+                while (run_one(worker)) {
+                };
+            };
+        };
+};
+
+// A frame drawn on the CPU instead of through SDL, with pixels as 0x00RRGGBB in rows from the top left
+// The screen is split into square tiles of raster_tile_size pixels, each listing the discs that touch it in drawing order,
+// so that tiles can be drawn on different threads without sharing a pixel. The vectors are kept between frames
+
+struct framebuffer {
+    int w;
+    int h;
+    int tiles_x;
+    int tiles_y;
+    std::vector<unsigned int> pixels;
+    std::vector<std::vector<int>> tiles;
+};
+
+// Sizes a framebuffer for a w by h frame, reusing its memory if it is already that size
+
+void resize_framebuffer(framebuffer *frame, int w, int h) {
+    frame->w = w;
+    frame->h = h;
+    frame->tiles_x = (w + raster_tile_size - 1) / raster_tile_size;
+    frame->tiles_y = (h + raster_tile_size - 1) / raster_tile_size;
+    frame->pixels.resize(static_cast<size_t>(w) * h);
+    frame->tiles.resize(frame->tiles_x * frame->tiles_y);
+};
+
+// Returns the colour of an orb's pixel distance of the way from its centre to its rim, matching how the fan drawn by
+// batch_disc blends from its blue centre vertex to its red rim
+
+unsigned int disc_colour(float distance) {
+    int red = static_cast<int>(fmin(distance, 1.0f) * 255.0f + 0.5f);
+    return static_cast<unsigned int>(red) << 16 | static_cast<unsigned int>(255 - red);
+};
+
+// Returns the pixel bounds [x0, x1) by [y0, y1) an orb covers, which are a square for orbs under lod_point_radius pixels
+
+void disc_bounds(view_orb *orb, int *x0, int *x1, int *y0, int *y1) {
+    float reach = orb->radius < lod_point_radius ? fmax(orb->radius, 0.5f) : orb->radius;
+    *x0 = static_cast<int>(floor(orb->x - reach));
+    *x1 = static_cast<int>(ceil(orb->x + reach));
+    *y0 = static_cast<int>(floor(orb->y - reach));
+    *y1 = static_cast<int>(ceil(orb->y + reach));
+};
+
+// Lists each orb in the tiles its bounds overlap. orbs must already be in drawing order, which the lists keep
+
+void bin_discs(framebuffer *frame, view_orb *orbs, int count) {
+    for (std::vector<int> &tile : frame->tiles) {
+        tile.clear();
+    };
+    for (int i = 0; i < count; i++) {
+        int x0, x1, y0, y1;
+        disc_bounds(&orbs[i], &x0, &x1, &y0, &y1);
+        if (x1 <= 0 || y1 <= 0 || x0 >= frame->w || y0 >= frame->h) {
+            continue;
+        };
+        int first_x = max(x0, 0) / raster_tile_size;
+        int last_x = min(x1 - 1, frame->w - 1) / raster_tile_size;
+        int first_y = max(y0, 0) / raster_tile_size;
+        int last_y = min(y1 - 1, frame->h - 1) / raster_tile_size;
+        for (int ty = first_y; ty <= last_y; ty++) {
+            for (int tx = first_x; tx <= last_x; tx++) {
+                frame->tiles[ty * frame->tiles_x + tx].push_back(i);
+            };
+        };
+    };
+};
+
+// Paints one orb over the pixels of the clip rectangle [left, right) by [top, bottom) whose centres it covers
+// Each row is a single span worked out from the circle's equation, filled four pixels at a time
+
+void fill_disc(framebuffer *frame, view_orb *orb, int left, int right, int top, int bottom) {
+    if (orb->radius < lod_point_radius) {
+        int x0, x1, y0, y1;
+        disc_bounds(orb, &x0, &x1, &y0, &y1);
+        for (int y = max(y0, top); y < min(y1, bottom); y++) {
+            unsigned int *row = frame->pixels.data() + static_cast<size_t>(y) * frame->w;
+            for (int x = max(x0, left); x < min(x1, right); x++) {
+                row[x] = 0xaa0055;
+            };
+        };
+        return;
+    };
+    float squared = orb->radius * orb->radius;
+    float inverse = 1.0f / orb->radius;
+    int first_row = max(top, static_cast<int>(ceil(orb->y - orb->radius - 0.5f)));
+    int last_row = min(bottom - 1, static_cast<int>(floor(orb->y + orb->radius - 0.5f)));
+    for (int y = first_row; y <= last_row; y++) {
+        float dy = y + 0.5f - orb->y;
+        if (dy * dy > squared) {
+            continue;
+        };
+        float half = sqrt(squared - dy * dy);
+        int start = max(left, static_cast<int>(ceil(orb->x - half - 0.5f)));
+        int end = min(right - 1, static_cast<int>(floor(orb->x + half - 0.5f))) + 1;
+        unsigned int *row = frame->pixels.data() + static_cast<size_t>(y) * frame->w;
+        int x = start;
+#ifdef __SSE2__
+        const __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 centre_x = _mm_set1_ps(orb->x);
+        const __m128 dy_squared = _mm_set1_ps(dy * dy);
+        const __m128 scale = _mm_set1_ps(inverse);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 full = _mm_set1_ps(255.0f);
+        const __m128 round = _mm_set1_ps(0.5f);
+        const __m128i blue = _mm_set1_epi32(255);
+        for (; x + 4 <= end; x += 4) {
+            __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), step), centre_x);
+            __m128 distance = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dy_squared)), scale);
+            __m128i red = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(distance, one), full), round));
+            __m128i colour = _mm_or_si128(_mm_slli_epi32(red, 16), _mm_sub_epi32(blue, red));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), colour);
+        };
+#endif
+        for (; x < end; x++) {
+            float dx = x + 0.5f - orb->x;
+            row[x] = disc_colour(sqrt(dx * dx + dy * dy) * inverse);
+        };
+    };
+};
+
+// Clears one tile to black and paints the orbs listed in it over each other in order
+
+void raster_tile(framebuffer *frame, view_orb *orbs, int tile) {
+    int left = (tile % frame->tiles_x) * raster_tile_size;
+    int top = (tile / frame->tiles_x) * raster_tile_size;
+    int right = min(left + raster_tile_size, frame->w);
+    int bottom = min(top + raster_tile_size, frame->h);
+    for (int y = top; y < bottom; y++) {
+        memset(frame->pixels.data() + static_cast<size_t>(y) * frame->w + left, 0, (right - left) * sizeof(unsigned int));
+    };
+    for (int index : frame->tiles[tile]) {
+        fill_disc(frame, &orbs[index], left, right, top, bottom);
+    };
+};
+
+// Draws a frame of orbs already sorted furthest first, splitting the tiles across pool if it is not NULL
+// Every pixel is painted by exactly one thread in the same order, so the frame is identical whatever the thread count
+
+void raster_frame(framebuffer *frame, view_orb *orbs, int count, thread_pool *pool) {
+    bin_discs(frame, orbs, count);
+    int tiles = frame->tiles_x * frame->tiles_y;
+    auto body = [&](int start, int end) {
+        for (int tile = start; tile < end; tile++) {
+            raster_tile(frame, orbs, tile);
+        };
+    };
+    if (pool == NULL) {
+        body(0, tiles);
+    } else {
+        pool->parallel_for(tiles, 1, body);
+    };
+};
+
+// A 5 by 7 pixel font for the HUD of frames drawn on the CPU, one row of bits per byte with the leftmost pixel highest
+// It covers the same glyphs as the HUD's glyph atlas, with lower case drawn as capitals
+
+const unsigned char raster_font[hud_last_glyph - hud_first_glyph + 1][7] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, {0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a},
+    {0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04}, {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, {0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d}, {0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00}, {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00},
+    {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08},
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},
+    {0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e}, {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},
+    {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},
+    {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, {0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e},
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, {0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e}, {0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f},
+    {0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},
+    {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},
+    {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, {0x03, 0x04, 0x04, 0x08, 0x04, 0x04, 0x03},
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, {0x18, 0x04, 0x04, 0x02, 0x04, 0x04, 0x18}, {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00},
+};
+
+// Draws text with its top at y = top, starting at x = anchor if left or ending there otherwise, in the same way as
+// layout_line. Each font pixel is a raster_font_scale pixel square
+
+void raster_text(framebuffer *frame, const char *text, bool left, int anchor, int top, unsigned int colour) {
+    int advance = 6 * raster_font_scale;
+    int pen = left ? anchor : anchor - static_cast<int>(strlen(text)) * advance;
+    for (const char *c = text; *c; c++, pen += advance) {
+        if (*c < hud_first_glyph || *c > hud_last_glyph) {
+            continue;
+        };
+        const unsigned char *glyph = raster_font[*c - hud_first_glyph];
+        for (int y = 0; y < 7 * raster_font_scale; y++) {
+            int row = top + y;
+            if (row < 0 || row >= frame->h) {
+                continue;
+            };
+            for (int x = 0; x < 5 * raster_font_scale; x++) {
+                int column = pen + x;
+                if (column >= 0 && column < frame->w && glyph[y / raster_font_scale] >> (4 - x / raster_font_scale) & 1) {
+                    frame->pixels[static_cast<size_t>(row) * frame->w + column] = colour;
+                };
+            };
+        };
+    };
+};
+
+// Returns a hash of every pixel, for comparing frames with known good ones
+
+unsigned long long frame_hash(framebuffer *frame) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned int pixel : frame->pixels) {
+        hash = (hash ^ pixel) * 1099511628211ULL;
+    };
+    return hash;
+};
+
+// Writes a frame to path as a binary PPM image, returning false if it could not be written
+
+bool save_ppm(framebuffer *frame, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Error writing frame %s\n", path);
+        return false;
+    };
+    std::vector<unsigned char> bytes(frame->pixels.size() * 3);
+    for (size_t i = 0; i < frame->pixels.size(); i++) {
+        bytes[i * 3] = frame->pixels[i] >> 16;
+        bytes[i * 3 + 1] = frame->pixels[i] >> 8;
+        bytes[i * 3 + 2] = frame->pixels[i];
+    };
+    fprintf(file, "P6\n%i %i\n255\n", frame->w, frame->h);
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    if (fclose(file) != 0 || !written) {
+        printf("Error writing frame %s\n", path);
+        return false;
+    };
+    return true;
+};
+
+// Places the camera alpha of the way from the previous tick's pose to the latest one, writing position and basis to out
+
+void interpolate_pose(point *previous_position, point *previous_basis, point *position, point *basis, float alpha,
+                      point *out_position, point *out_basis) {
+    *out_position = {
+        x : previous_position->x + (position->x - previous_position->x) * alpha,
+        y : previous_position->y + (position->y - previous_position->y) * alpha,
+        z : previous_position->z + (position->z - previous_position->z) * alpha
+    };
+    for (int i = 0; i < 3; i++) {
+        out_basis[i] = {
+            x : previous_basis[i].x + (basis[i].x - previous_basis[i].x) * alpha,
+            y : previous_basis[i].y + (basis[i].y - previous_basis[i].y) * alpha,
+            z : previous_basis[i].z + (basis[i].z - previous_basis[i].z) * alpha
+        };
+        normalise(&out_basis[i]);
+    };
+};
+
+// Everything a frame needs from the simulation at the end of one tick: both poses to interpolate between and a copy of
+// the orbs that could be in view. Once published it is never written again until the renderer has let go of it
+// time is when the tick was due, so the renderer can tell how far it is towards the next one
+
+struct world_snapshot {
+    long tick;
+    double time;
+    double start_time;
+    float tick_seconds;
+    bool game_over;
+    const char *loss_reason;
+    point position;
+    point previous_position;
+    point basis[3];
+    point previous_basis[3];
+    std::vector<int> indices;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> velocity_x;
+    std::vector<float> velocity_y;
+    std::vector<float> velocity_z;
+    std::vector<float> radius;
+};
+
+// Start of a saved world file. Everything a game needs to carry on from the tick it was saved at is in the file, with
+// the orb arrays stored at offsets from the start so the file can be mapped anywhere and used without parsing
+// The random streams depend only on the seed, orb and tick, so those are all the random state there is
+// hash is the state_hash of the saved game, checked on loading
+
+struct world_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int header_size;
+    unsigned int seed;
+    long long tick;
+    scenario world;
+    float player_velocity;
+    point position;
+    point basis[3];
+    point previous_position;
+    point previous_basis[3];
+    int object_count;
+    unsigned long long offsets[7];
+    unsigned long long size;
+    unsigned long long hash;
+};
+
+// A saved world mapped into memory, read only
+
+struct world_file {
+    void *data;
+    size_t size;
+    world_header *header;
+};
+
+// Returns the address of one of the orb arrays of a mapped world
+
+float *world_field(world_file *file, int field) {
+    return reinterpret_cast<float *>(static_cast<char *>(file->data) + file->header->offsets[field]);
+};
+
+// Reasons a game can be lost, kept as named strings so that callers can tell them apart
+
+const char *lost_to_bounds = "Game lost: player out of bounds";
+const char *lost_to_orb = "Game lost: impacted flying orb";
+
+// Main game state class
+
+class gameState {
+    public:
+        double start_time;
+        float tick_seconds;
+        float player_x;
+        float player_y;
+        float player_z;
+        bool accelerating;
+        bool turning_left;
+        bool turning_right;
+        bool turning_up;
+        bool turning_down;
+        point forward_belief;
+        point right_belief;
+        point up_belief;
+        const char *loss_reason;
+
+        // Allocates all the storage a game in settings will need up front, so that nothing is allocated while it runs
+
+        gameState(scenario settings = default_scenario()) {
+            world = settings;
+            max_objects = world.max_objects;
+            object_count = 0;
+            tick_seconds = millisecond_frame_delay / 1000.0f;
+            seed = default_seed;
+            games = 0;
+            pool = NULL;
+            prewarmed = NULL;
+            allocate_orbs(&objects, max_objects);
+            allocate_grid(&grid, &world);
+            if (world.orb_collisions) {
+                allocate_sweep(&sweep, &world);
+            };
+        };
+
+        ~gameState() {
+            free_orbs(&objects);
+            free_grid(&grid);
+        };
+
+        // Finds the orbs in view for a window of the given size and projects them into order, unsorted
+        // The view is placed alpha of the way from the previous tick to the latest one. Returns the number projected
+
+        int view_frame(int h, int w, float alpha = 1.0f) {
+            point position = {player_x, player_y, player_z};
+            point latest[3] = {forward_belief, right_belief, up_belief};
+            point player;
+            point basis[3];
+            interpolate_pose(&previous_position, previous_basis, &position, latest, alpha, &player, basis);
+            grid_query_view(&grid, &player, &basis[0], &visible);
+            view_basis view;
+            build_view(&view, &player, &basis[0], &basis[1], &basis[2], h, w);
+            order.resize(visible.size());
+            return transform_orbs(&view, &objects, visible.data(), visible.size(), (1.0f - alpha) * tick_seconds, order.data());
+        };
+
+        // Copies the poses and the orbs the grid finds in view of the latest pose into snapshot, as of time
+        // The query's cell margin covers the at most one tick of motion back to the previous pose
+
+        void take_snapshot(world_snapshot *snapshot, bool game_over, double time) {
+            PROFILE_SCOPE(phase_snapshot);
+            point position = {player_x, player_y, player_z};
+            grid_query_view(&grid, &position, &forward_belief, &visible);
+            int count = visible.size();
+            snapshot->tick = tick;
+            snapshot->time = time;
+            snapshot->start_time = start_time;
+            snapshot->tick_seconds = tick_seconds;
+            snapshot->game_over = game_over;
+            snapshot->loss_reason = loss_reason;
+            snapshot->position = position;
+            snapshot->previous_position = previous_position;
+            snapshot->basis[0] = forward_belief;
+            snapshot->basis[1] = right_belief;
+            snapshot->basis[2] = up_belief;
+            for (int i = 0; i < 3; i++) {
+                snapshot->previous_basis[i] = previous_basis[i];
+            };
+            snapshot->indices.resize(count);
+            std::vector<float> *fields[] = {&snapshot->x, &snapshot->y, &snapshot->z, &snapshot->velocity_x,
+                                            &snapshot->velocity_y, &snapshot->velocity_z, &snapshot->radius};
+            float *sources[] = {objects.x, objects.y, objects.z, objects.velocity_x, objects.velocity_y, objects.velocity_z, objects.radius};
+            for (int f = 0; f < 7; f++) {
+                fields[f]->resize(count);
+                float *to = fields[f]->data();
+                for (int i = 0; i < count; i++) {
+                    to[i] = sources[f][visible[i]];
+                };
+            };
+            for (int i = 0; i < count; i++) {
+                snapshot->indices[i] = i;
+            };
+        };
+
+        // Updates the physics of everything between frames
+        // Afterwards the first respawned of objects.respawn are the orbs respawned this tick, orbs from spawned_from on are
+        // new, and with orb collisions the sweep's contacts are the orbs bounced, which is every orb whose course changed
+
+        void update(bool *game_over) {
+            PROFILE_SCOPE(phase_tick);
+            tick++;
+            previous_position = {player_x, player_y, player_z};
+            previous_basis[0] = forward_belief;
+            previous_basis[1] = right_belief;
+            previous_basis[2] = up_belief;
+            if (accelerating) {
+                player_velocity += forward_thruster_power * tick_seconds;
+            } else {
+                player_velocity = player_velocity * (1 - deceleration_rate * tick_seconds);
+            };
+            turn_basis(&forward_belief, &right_belief, &up_belief, turning_right - turning_left, turning_down - turning_up,
+                       angular_thruster_power * tick_seconds);
+            point motion = {
+                x : player_velocity * forward_belief.x * tick_seconds,
+                y : player_velocity * forward_belief.y * tick_seconds,
+                z : player_velocity * forward_belief.z * tick_seconds
+            };
+            player_x += motion.x;
+            player_y += motion.y;
+            player_z += motion.z;
+            float wall_impact = ignore_losing ? -1 : sweep_walls(&world.low, &world.high, &previous_position, &motion, player_radius);
+            spawned_from = object_count;
+            spawn_orbs(min(world.spawn_rate, max_objects - object_count));
+            // Each chunk lists its respawned and moved orbs from its own start, and the lists are then joined in chunk order
+            int chunks = (object_count + integrate_chunk - 1) / integrate_chunk;
+            int respawn_count = 0;
+            int moved_count = 0;
+            {
+                PROFILE_SCOPE(phase_integrate);
+                chunk_respawns.assign(chunks, 0);
+                chunk_moves.assign(chunks, 0);
+                run_parallel(object_count, integrate_chunk, [&](int start, int end) {
+                    for (int c = start; c < end; c += integrate_chunk) {
+                        int moved;
+                        chunk_respawns[c / integrate_chunk] = integrate_orbs(&objects, c, min(c + integrate_chunk, end), tick_seconds, &grid, &moved);
+                        chunk_moves[c / integrate_chunk] = moved;
+                    };
+                });
+                for (int c = 0; c < chunks; c++) {
+                    memmove(objects.respawn + respawn_count, objects.respawn + c * integrate_chunk, chunk_respawns[c] * sizeof(int));
+                    memmove(objects.moved + moved_count, objects.moved + c * integrate_chunk, chunk_moves[c] * sizeof(int));
+                    respawn_count += chunk_respawns[c];
+                    moved_count += chunk_moves[c];
+                };
+                respawned = respawn_count;
+            };
+            {
+                PROFILE_SCOPE(phase_grid);
+                update_grid(&grid, &objects, objects.moved, moved_count);
+                // Collisions are found along the whole of the tick's path, so the player cannot pass through anything between
+                // ticks however fast it goes, and the game ends at whichever it touched first with the player stopped there
+                // Orbs that left the box are swept before they respawn, along the path they really took, and a respawned orb
+                // is first swept next tick from where it reappeared
+                float orb_impact = grid_sweep_player(&grid, &objects, &previous_position, &motion, player_radius, tick_seconds);
+                float impact = orb_impact >= 0 && (wall_impact < 0 || orb_impact <= wall_impact) ? orb_impact : wall_impact;
+                if (impact >= 0) {
+                    *game_over = true;
+                    loss_reason = impact == orb_impact ? lost_to_orb : lost_to_bounds;
+                    player_x = previous_position.x + motion.x * impact;
+                    player_y = previous_position.y + motion.y * impact;
+                    player_z = previous_position.z + motion.z * impact;
+                };
+            };
+            {
+                PROFILE_SCOPE(phase_respawn);
+                run_parallel(respawn_count, respawn_chunk, [&](int start, int end) {
+                    for (int i = start; i < end; i++) {
+                        spawn(objects.respawn[i]); // Automatically overwrites the old one
+                    };
+                });
+                update_grid(&grid, &objects, objects.respawn, respawn_count);
+            };
+            // Bounces change velocities only after the player's sweep, which relies on them to trace this tick's motion
+            if (world.orb_collisions) {
+                PROFILE_SCOPE(phase_collide);
+                collide_orbs(respawn_count);
+            };
+        };
+
+        // Bounces touching orbs that are moving together off each other, given the orbs respawned this tick
+        // Contacts are found across the pool and then resolved one band at a time in order, so the result is the same
+        // whatever the thread count
+
+        void collide_orbs(int respawn_count) {
+            sort_sweep(&sweep, &objects, object_count, objects.respawn, respawn_count);
+            run_parallel(sweep.bands_per_axis * sweep.bands_per_axis, sweep_chunk, [&](int start, int end) {
+                sweep_bands(&sweep, &objects, start, end);
+            });
+            for (std::vector<int> &contacts : sweep.contacts) {
+                for (size_t c = 0; c < contacts.size(); c += 2) {
+                    bounce_orbs(&objects, contacts[c], contacts[c + 1]);
+                };
+            };
+        };
+
+        // Creates a new orb in slot index
+
+        void spawn(int index) {
+            flying_object created;
+            random_stream stream = make_stream(seed, index, tick);
+            create_object(&created, &world, &stream);
+            store_object(&objects, index, &created);
+        };
+
+        // Adds count new orbs in the slots after the last one in flight, all at once across the pool
+        // They are filed in the grid on the next tick, like orbs that have moved cell
+
+        void spawn_orbs(int count) {
+            int first = object_count;
+            run_parallel(count, respawn_chunk, [&](int start, int end) {
+                for (int i = first + start; i < first + end; i++) {
+                    objects.cell[i] = -1;
+                    spawn(i);
+                };
+            });
+            object_count += count;
+        };
+
+        // Runs body over [0, count) in chunks on the pool if there is one, or on this thread otherwise
+        // A chunk covers whole multiples of chunk, so body may be given several chunks' worth at once
+
+        void run_parallel(int count, int chunk, std::function<void(int, int)> body) {
+            if (pool == NULL) {
+                body(0, count);
+            } else {
+                pool->parallel_for(count, chunk, body);
+            };
+        };
+
+        // Initialises variables before a new game
+
+        // If prewarmed is set the game starts from that saved world instead of an empty box
 
         void initialise() {
-            start_time = time(NULL);
-            player_x = 0;
-            player_y = 0;
-            player_z = 0;
-            forward_belief = {1, 0, 0};
-            right_belief = {0, 1, 0};
-            up_belief = {0, 0, 1};
-            player_velocity = 0;
+            start_time = now_seconds();
+            games++;
+            tick = 0;
+            place_player();
+            clear_grid(&grid);
+            sweep.order.clear();
             object_count = 0;
             accelerating = false;
             turning_down = false;
             turning_up = false;
             turning_left = false;
             turning_right = false;
+            if (prewarmed != NULL) {
+                restore(prewarmed);
+            };
+            respawned = 0;
+            spawned_from = object_count;
+        };
+
+        // Puts the player still at the centre of the box, facing along x
+
+        void place_player() {
+            player_x = (world.low.x + world.high.x) / 2;
+            player_y = (world.low.y + world.high.y) / 2;
+            player_z = (world.low.z + world.high.z) / 2;
+            forward_belief = {1, 0, 0};
+            right_belief = {0, 1, 0};
+            up_belief = {0, 0, 1};
+            previous_position = {player_x, player_y, player_z};
+            previous_basis[0] = forward_belief;
+            previous_basis[1] = right_belief;
+            previous_basis[2] = up_belief;
+            player_velocity = 0;
+            loss_reason = NULL;
+        };
+
+        // Takes the player, orbs and tick from a mapped world saved from a game of the same scenario, and files every orb in
+        // the grid. The orbs are copied straight out of the mapping
+
+        void restore(world_file *file) {
+            world_header *header = file->header;
+            seed = header->seed;
+            tick = header->tick;
+            player_velocity = header->player_velocity;
+            player_x = header->position.x;
+            player_y = header->position.y;
+            player_z = header->position.z;
+            forward_belief = header->basis[0];
+            right_belief = header->basis[1];
+            up_belief = header->basis[2];
+            previous_position = header->previous_position;
+            for (int i = 0; i < 3; i++) {
+                previous_basis[i] = header->previous_basis[i];
+            };
+            object_count = min(header->object_count, max_objects);
+            float *fields[] = {objects.x, objects.y, objects.z, objects.velocity_x, objects.velocity_y, objects.velocity_z, objects.radius};
+            for (int f = 0; f < 7; f++) {
+                memcpy(fields[f], world_field(file, f), object_count * sizeof(float));
+            };
+            clear_grid(&grid);
+            for (int i = 0; i < object_count; i++) {
+                objects.cell[i] = -1;
+                objects.moved[i] = i;
+            };
+            update_grid(&grid, &objects, objects.moved, object_count);
+        };
+
+        // Runs the world for ticks with no player input and collisions ignored, then puts the player back at the start and
+        // sends any orb within prewarm_clearance of them back to the boundary, so that a game can begin among orbs that
+        // are already spread through the box
+
+        void prewarm(long ticks) {
+            bool game_over = false;
+            for (long i = 0; i < ticks; i++) {
+                update(&game_over);
+            };
+            place_player();
+            int cleared = 0;
+            for (int i = 0; i < object_count; i++) {
+                float dx = objects.x[i] - player_x;
+                float dy = objects.y[i] - player_y;
+                float dz = objects.z[i] - player_z;
+                float reach = prewarm_clearance + objects.radius[i];
+                if (dx * dx + dy * dy + dz * dz < reach * reach) {
+                    spawn(i);
+                    objects.respawn[cleared++] = i;
+                };
+            };
+            update_grid(&grid, &objects, objects.respawn, cleared);
+        };
+
+        // Skips the warm up period by spawning orbs until count are in flight
+
+        void populate(int count) {
+            spawn_orbs(max(min(count, max_objects) - object_count, 0));
+        };
+
+        // Returns a hash of the player and every orb, to check that two runs reached exactly the same state
+        // Everything hashed is 4 bytes wide, so it is taken a word at a time to stay cheap enough to check every tick
+
+        unsigned long long state_hash() {
+            unsigned long long hash = 14695981039346656037ULL;
+            auto add = [&hash](const void *data, size_t bytes) {
+                const unsigned char *bytes_in = static_cast<const unsigned char *>(data);
+                for (size_t i = 0; i < bytes; i += sizeof(unsigned int)) {
+                    unsigned int word;
+                    memcpy(&word, bytes_in + i, sizeof(word));
+                    hash = (hash ^ word) * 1099511628211ULL;
+                };
+            };
+            float pose[13] = {player_x, player_y, player_z, player_velocity,
+                              forward_belief.x, forward_belief.y, forward_belief.z,
+                              right_belief.x, right_belief.y, right_belief.z,
+                              up_belief.x, up_belief.y, up_belief.z};
+            add(pose, sizeof(pose));
+            add(&object_count, sizeof(object_count));
+            float *fields[] = {objects.x, objects.y, objects.z, objects.velocity_x, objects.velocity_y, objects.velocity_z, objects.radius};
+            for (float *field : fields) {
+                add(field, object_count * sizeof(float));
+            };
+            return hash;
+        };
+        float player_velocity;
+        unsigned long long seed;
+        long tick;
+        long games;
+        int respawned;
+        int spawned_from;
+        thread_pool *pool;
+        world_file *prewarmed;
+        std::vector<int> chunk_respawns;
+        std::vector<int> chunk_moves;
+        point previous_position;
+        point previous_basis[3];
+        scenario world;
+        orb_storage objects;
+        spatial_grid grid;
+        sweep_prune sweep;
+        std::vector<int> visible;
+        std::vector<view_orb> order;
+        draw_order draw;
+        int max_objects;
+        int object_count;
+    };
+
+// Saves the game state is playing to path as a world that games can start from, returning false if it could not be
+// written. The header is followed by each orb array, every one starting on a cache line
+
+bool save_world(gameState *state, const char *path) {
+    world_header header = {};
+    header.magic = world_magic;
+    header.version = world_version;
+    header.header_size = sizeof(world_header);
+    header.seed = state->seed;
+    header.tick = state->tick;
+    header.world = state->world;
+    header.player_velocity = state->player_velocity;
+    header.position = {state->player_x, state->player_y, state->player_z};
+    header.basis[0] = state->forward_belief;
+    header.basis[1] = state->right_belief;
+    header.basis[2] = state->up_belief;
+    header.previous_position = state->previous_position;
+    for (int i = 0; i < 3; i++) {
+        header.previous_basis[i] = state->previous_basis[i];
+    };
+    header.object_count = state->object_count;
+    size_t field_size = state->object_count * sizeof(float);
+    size_t padded = (field_size + cache_line_size - 1) / cache_line_size * cache_line_size;
+    size_t offset = (sizeof(world_header) + cache_line_size - 1) / cache_line_size * cache_line_size;
+    for (int f = 0; f < 7; f++) {
+        header.offsets[f] = offset;
+        offset += padded;
+    };
+    header.size = offset;
+    header.hash = state->state_hash();
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Error writing world %s\n", path);
+        return false;
+    };
+    float *fields[] = {state->objects.x, state->objects.y, state->objects.z, state->objects.velocity_x,
+                       state->objects.velocity_y, state->objects.velocity_z, state->objects.radius};
+    std::vector<char> padding(cache_line_size, 0);
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(padding.data(), 1, header.offsets[0] - sizeof(header), file) == header.offsets[0] - sizeof(header);
+    for (int f = 0; f < 7 && written; f++) {
+        written = fwrite(fields[f], 1, field_size, file) == field_size &&
+                  fwrite(padding.data(), 1, padded - field_size, file) == padded - field_size;
+    };
+    if (fclose(file) != 0 || !written) {
+        printf("Error writing world %s\n", path);
+        return false;
+    };
+    return true;
+};
+
+// Maps a saved world from path into file, returning false, saying why, if it is missing or not a world of this version
+
+bool map_world(world_file *file, const char *path) {
+    file->data = NULL;
+    int descriptor = open(path, O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0) {
+        printf("Error opening world %s\n", path);
+        if (descriptor >= 0) {
+            close(descriptor);
+        };
+        return false;
+    };
+    file->size = status.st_size;
+    if (file->size >= sizeof(world_header)) {
+        file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        file->data = file->data == MAP_FAILED ? NULL : file->data;
+    };
+    close(descriptor);
+    file->header = static_cast<world_header *>(file->data);
+    world_header *header = file->header;
+    bool valid = header != NULL && header->magic == world_magic && header->version == world_version &&
+                 header->header_size == sizeof(world_header) && header->size == file->size && header->object_count >= 0 &&
+                 header->object_count <= header->world.max_objects;
+    for (int f = 0; f < 7 && valid; f++) {
+        valid = header->offsets[f] % cache_line_size == 0 && header->offsets[f] + header->object_count * sizeof(float) <= file->size;
+    };
+    // The scenario in a world file is trusted no more than one read from text, as it sizes the grid and every orb array
+    if (!valid) {
+        printf("Error reading world %s: not a normallight world of this version\n", path);
+    } else if (!valid_scenario(&header->world)) {
+        printf("Error reading world %s: its scenario is out of range\n", path);
+        valid = false;
+    };
+    if (!valid) {
+        if (file->data != NULL) {
+            munmap(file->data, file->size);
+            file->data = NULL;
+        };
+    };
+    return valid;
+};
+
+// Unmaps a world mapped by map_world
+
+void unmap_world(world_file *file) {
+    if (file->data != NULL) {
+        munmap(file->data, file->size);
+        file->data = NULL;
+    };
+};
+
+// Prewarms a world of the given scenario for ticks, or for long enough to fill it and run prewarm_ticks more if ticks is
+// negative, then saves it to path
+
+bool build_world(unsigned int seed, long ticks, float tick_seconds, scenario *world, thread_pool *pool, const char *path) {
+    gameState *state = new gameState(*world);
+    state->seed = seed;
+    state->pool = pool;
+    state->tick_seconds = tick_seconds;
+    state->initialise();
+    if (ticks < 0) {
+        ticks = (world->max_objects + world->spawn_rate - 1) / world->spawn_rate + prewarm_ticks;
+    };
+    auto begin = std::chrono::steady_clock::now();
+    state->prewarm(ticks);
+    bool saved = save_world(state, path);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (saved) {
+        printf("Saved a world of %i orbs after %li ticks to %s in %.3f seconds\n", state->object_count, ticks, path, seconds);
+    };
+    delete state;
+    return saved;
+};
+
+// Loads a mapped world into a game to check that it arrives exactly as saved, reporting how long loading took
+
+bool check_world(world_file *file, thread_pool *pool) {
+    gameState *state = new gameState(file->header->world);
+    state->pool = pool;
+    state->prewarmed = file;
+    auto begin = std::chrono::steady_clock::now();
+    state->initialise();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    bool matched = state->state_hash() == file->header->hash;
+    if (matched) {
+        printf("Loaded a world of %i orbs at tick %lli in %.3f ms\n", state->object_count, file->header->tick, seconds * 1000);
+    } else {
+        printf("Error loading world: its orbs do not match the hash it was saved with\n");
+    };
+    delete state;
+    return matched;
+};
+
+// A game's seed, scenario and inputs, with the state hash after every tick, so that the game can be replayed exactly
+// Inputs are stored only when they change, as the number of ticks since the last change followed by the packed flags
+
+// world_hash is the hash of the saved world the game started from, or 0 if it started from an empty box
+// game counts the games recorded to path this session, so that each restart is saved beside the last rather than over it
+
+struct input_recording {
+    const char *path;
+    int game;
+    unsigned int seed;
+    float tick_seconds;
+    scenario world;
+    unsigned long long world_hash;
+    long ticks;
+    long last_change;
+    unsigned char last_flags;
+    std::vector<unsigned char> events;
+    std::vector<unsigned int> hashes;
+};
+
+// Packs the state's input flags into one byte
+
+unsigned char input_flags(gameState *state) {
+    return state->accelerating | state->turning_left << 1 | state->turning_right << 2 | state->turning_up << 3 | state->turning_down << 4;
+};
+
+// Sets the state's input flags from a byte packed by input_flags
+
+void set_input_flags(gameState *state, unsigned char flags) {
+    state->accelerating = flags & 1;
+    state->turning_left = flags & 2;
+    state->turning_right = flags & 4;
+    state->turning_up = flags & 8;
+    state->turning_down = flags & 16;
+};
+
+// Starts an empty recording of the game state is about to play, to be saved to path
+
+void start_recording(input_recording *recording, gameState *state) {
+    recording->game++;
+    recording->seed = state->seed;
+    recording->tick_seconds = state->tick_seconds;
+    recording->world = state->world;
+    recording->world_hash = state->prewarmed != NULL ? state->prewarmed->header->hash : 0;
+    recording->ticks = 0;
+    recording->last_change = 0;
+    recording->last_flags = 0;
+    recording->events.clear();
+    recording->hashes.clear();
+};
+
+// Records a tick just run by state: the inputs it was run with, if they changed, and the hash of the state after it
+
+void record_tick(input_recording *recording, gameState *state) {
+    PROFILE_SCOPE(phase_record);
+    unsigned char flags = input_flags(state);
+    if (flags != recording->last_flags) {
+        unsigned long gap = recording->ticks - recording->last_change;
+        while (gap >= 128) {
+            recording->events.push_back((gap & 127) | 128);
+            gap >>= 7;
+        };
+        recording->events.push_back(gap);
+        recording->events.push_back(flags);
+        recording->last_change = recording->ticks;
+        recording->last_flags = flags;
+    };
+    unsigned long long hash = state->state_hash();
+    recording->hashes.push_back(static_cast<unsigned int>(hash ^ hash >> 32));
+    recording->ticks++;
+};
+
+// Writes the recording to its path, or for the second and later games of a session to its path followed by the game
+// number, as in game.rec.2. Returns false if it could not be written
+// Layout, in native byte order: magic, version, seed, tick length, scenario, world hash, ticks, event bytes, events,
+// then one hash per tick
+
+bool save_recording(input_recording *recording) {
+    char path[4096];
+    if (recording->game > 1) {
+        snprintf(path, sizeof(path), "%s.%i", recording->path, recording->game);
+    } else {
+        snprintf(path, sizeof(path), "%s", recording->path);
+    };
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Error writing recording %s\n", path);
+        return false;
+    };
+    unsigned int header[3] = {recording_magic, recording_version, recording->seed};
+    unsigned int sizes[2] = {static_cast<unsigned int>(recording->ticks), static_cast<unsigned int>(recording->events.size())};
+    bool written = fwrite(header, sizeof(header), 1, file) == 1 &&
+                   fwrite(&recording->tick_seconds, sizeof(float), 1, file) == 1 &&
+                   fwrite(&recording->world, sizeof(scenario), 1, file) == 1 &&
+                   fwrite(&recording->world_hash, sizeof(recording->world_hash), 1, file) == 1 &&
+                   fwrite(sizes, sizeof(sizes), 1, file) == 1 &&
+                   fwrite(recording->events.data(), 1, recording->events.size(), file) == recording->events.size() &&
+                   fwrite(recording->hashes.data(), sizeof(unsigned int), recording->ticks, file) == static_cast<size_t>(recording->ticks);
+    if (fclose(file) != 0 || !written) {
+        printf("Error writing recording %s\n", path);
+        return false;
+    };
+    return true;
+};
+
+// Reads a recording saved by save_recording from path, returning false if it is missing or not a recording
+
+bool load_recording(input_recording *recording, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Error opening recording %s\n", path);
+        return false;
+    };
+    unsigned int header[3];
+    unsigned int sizes[2];
+    bool read = fread(header, sizeof(header), 1, file) == 1 && header[0] == recording_magic && header[1] == recording_version &&
+                fread(&recording->tick_seconds, sizeof(float), 1, file) == 1 &&
+                fread(&recording->world, sizeof(scenario), 1, file) == 1 &&
+                fread(&recording->world_hash, sizeof(recording->world_hash), 1, file) == 1 &&
+                fread(sizes, sizeof(sizes), 1, file) == 1;
+    if (read) {
+        recording->path = path;
+        recording->seed = header[2];
+        recording->ticks = sizes[0];
+        recording->events.resize(sizes[1]);
+        recording->hashes.resize(sizes[0]);
+        read = fread(recording->events.data(), 1, sizes[1], file) == sizes[1] &&
+               fread(recording->hashes.data(), sizeof(unsigned int), sizes[0], file) == sizes[0];
+    };
+    fclose(file);
+    if (!read) {
+        printf("Error reading recording %s: not a normallight recording of this version\n", path);
+    };
+    return read;
+};
+
+// Position in a recording's input changes during replay
+
+struct replay_cursor {
+    size_t offset;
+    long next_change;
+    unsigned char flags;
+};
+
+// Reads the next input change from the recording into cursor, or marks there being none left
+
+void next_change(input_recording *recording, replay_cursor *cursor) {
+    if (cursor->offset >= recording->events.size()) {
+        cursor->next_change = -1;
+        return;
+    };
+    unsigned long gap = 0;
+    int shift = 0;
+    while (recording->events[cursor->offset] & 128) {
+        gap |= static_cast<unsigned long>(recording->events[cursor->offset++] & 127) << shift;
+        shift += 7;
+    };
+    gap |= static_cast<unsigned long>(recording->events[cursor->offset++]) << shift;
+    cursor->next_change += gap;
+    cursor->flags = recording->events[cursor->offset++];
+};
+
+// Keys the player can press, as passed from the event loop to the simulation thread
+
+enum input_key {
+    key_accelerate,
+    key_left,
+    key_right,
+    key_up,
+    key_down,
+    key_restart
+};
+
+// A key going down or up at time, in now_seconds
+
+struct input_event {
+    input_key key;
+    bool pressed;
+    double time;
+};
+
+// Single producer, single consumer ring of input events. Only the event loop pushes and only the simulation thread
+// pops, so each end owns one counter and reads the other's, and neither ever waits
+
+struct input_queue {
+    input_event events[input_queue_size];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+};
+
+// Empties the queue before either thread uses it
+
+void start_input_queue(input_queue *queue) {
+    queue->head = 0;
+    queue->tail = 0;
+};
+
+// Adds event to the queue, returning false and dropping it if the queue is full
+
+bool push_input(input_queue *queue, input_event event) {
+    unsigned int tail = queue->tail.load(std::memory_order_relaxed);
+    if (tail - queue->head.load(std::memory_order_acquire) == input_queue_size) {
+        return false;
+    };
+    queue->events[tail % input_queue_size] = event;
+    queue->tail.store(tail + 1, std::memory_order_release);
+    return true;
+};
+
+// Copies the oldest event in the queue into event without taking it, returning false if there was none
+
+bool peek_input(input_queue *queue, input_event *event) {
+    unsigned int head = queue->head.load(std::memory_order_relaxed);
+    if (head == queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    };
+    *event = queue->events[head % input_queue_size];
+    return true;
+};
+
+// Takes the oldest event from the queue into event, returning false if there was none
+
+bool pop_input(input_queue *queue, input_event *event) {
+    unsigned int head = queue->head.load(std::memory_order_relaxed);
+    if (head == queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    };
+    *event = queue->events[head % input_queue_size];
+    queue->head.store(head + 1, std::memory_order_release);
+    return true;
+};
+
+// Sets the state's input flag for a key press or release. Restarting is left to the caller
+
+void apply_input(gameState *state, input_event *event) {
+    switch (event->key) {
+        case key_accelerate:
+            state->accelerating = event->pressed;
+            break;
+        case key_left:
+            state->turning_left = event->pressed;
+            break;
+        case key_right:
+            state->turning_right = event->pressed;
+            break;
+        case key_up:
+            state->turning_up = event->pressed;
+            break;
+        case key_down:
+            state->turning_down = event->pressed;
+            break;
+        default:
+            break;
+    };
+};
+
+// Triple buffer of snapshots passed from the simulation thread to the render thread without locks. The simulation
+// fills back and swaps it for middle, and the renderer swaps front for middle when a newer one is waiting there
+// middle holds a slot number with snapshot_fresh set if it has been published since the renderer last took it
+
+const int snapshot_fresh = 4;
+
+struct snapshot_exchange {
+    world_snapshot slots[3];
+    std::atomic<int> middle;
+    int back;
+    int front;
+};
+
+// Sets up the slots so that the renderer sees an empty snapshot until the first one is published
+
+void start_exchange(snapshot_exchange *exchange) {
+    for (int i = 0; i < 3; i++) {
+        exchange->slots[i].tick = -1;
+    };
+    exchange->back = 0;
+    exchange->middle = 1;
+    exchange->front = 2;
+};
+
+// Returns the slot the simulation thread is free to fill
+
+world_snapshot *back_snapshot(snapshot_exchange *exchange) {
+    return &exchange->slots[exchange->back];
+};
+
+// Makes the filled back slot the latest snapshot, taking whichever slot was waiting in the middle to fill next
+
+void publish_snapshot(snapshot_exchange *exchange) {
+    exchange->back = exchange->middle.exchange(exchange->back | snapshot_fresh) & 3;
+};
+
+// Returns the latest published snapshot, which stays untouched until the next call
+
+world_snapshot *latest_snapshot(snapshot_exchange *exchange) {
+    if (exchange->middle.load() & snapshot_fresh) {
+        exchange->front = exchange->middle.exchange(exchange->front) & 3;
+    };
+    return &exchange->slots[exchange->front];
+};
+
+// Spectators watch a game from another process over a Unix domain socket. Orbs fly in straight lines between respawns
+// and bounces, so a spectator is only sent an orb when its course changes, and works out where it has flown since
+// Each orb is sent as where it was at a tick, quantised to 1/spectator_position_scale, and the velocity it has had since
+
+struct spectator_orb {
+    long tick;
+    int position[3];
+    float velocity[3];
+    float radius;
+};
+
+// Works out where orb has flown to by tick, quantised like a position sent to spectators. Both ends work it out the same
+// way, so an orb that bounced can be sent as how far it is from where the spectator thinks it is
+
+void predict_orb(spectator_orb *orb, long tick, float tick_seconds, int *out) {
+    float elapsed = (tick - orb->tick) * tick_seconds;
+    for (int a = 0; a < 3; a++) {
+        out[a] = lrintf((orb->position[a] / spectator_position_scale + orb->velocity[a] * elapsed) * spectator_position_scale);
+    };
+};
+
+// Appends value to bytes seven bits at a time, lowest first, with the top bit set on every byte but the last
+
+void put_varint(std::vector<unsigned char> *bytes, unsigned long long value) {
+    while (value >= 128) {
+        bytes->push_back((value & 127) | 128);
+        value >>= 7;
+    };
+    bytes->push_back(value);
+};
+
+// Appends a signed value as a varint, zigzagged so that small values either side of 0 take few bytes
+
+void put_signed(std::vector<unsigned char> *bytes, long long value) {
+    put_varint(bytes, static_cast<unsigned long long>(value) << 1 ^ (value < 0 ? ~0ULL : 0));
+};
+
+// Appends size bytes from data as they are in memory
+
+void put_raw(std::vector<unsigned char> *bytes, const void *data, size_t size) {
+    const unsigned char *in = static_cast<const unsigned char *>(data);
+    bytes->insert(bytes->end(), in, in + size);
+};
+
+// Reads values back in order from size bytes at data. failed is set, and 0 read, once anything runs past the end
+
+struct byte_reader {
+    const unsigned char *data;
+    size_t size;
+    size_t at;
+    bool failed;
+};
+
+// Reads a varint appended by put_varint
+
+unsigned long long read_varint(byte_reader *reader) {
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64 && reader->at < reader->size; shift += 7) {
+        unsigned char byte = reader->data[reader->at++];
+        value |= static_cast<unsigned long long>(byte & 127) << shift;
+        if (byte < 128) {
+            return value;
+        };
+    };
+    reader->failed = true;
+    return 0;
+};
+
+// Reads a signed value appended by put_signed
+
+long long read_signed(byte_reader *reader) {
+    unsigned long long value = read_varint(reader);
+    return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+};
+
+// Reads size bytes appended by put_raw into out
+
+void read_raw(byte_reader *reader, void *out, size_t size) {
+    if (reader->size - reader->at < size) {
+        reader->failed = true;
+        memset(out, 0, size);
+        return;
+    };
+    memcpy(out, reader->data + reader->at, size);
+    reader->at += size;
+};
+
+// How a spectator is to be sent an orb whose course has changed: respawned and new orbs are sent whole, and bounced ones
+// as the difference from where the spectator would otherwise have them
+
+const unsigned char orb_bounced = 1;
+const unsigned char orb_whole = 2;
+
+// An orb as sent in an update the spectator has not acknowledged yet, which becomes known once it has
+
+struct spectator_sent {
+    int orb;
+    spectator_orb course;
+};
+
+// An update sent to a spectator and not acknowledged yet: its tick, and how many orbs in sent it carried
+
+struct spectator_outstanding {
+    long tick;
+    size_t orbs;
+};
+
+// One spectator of a spectator_server. Updates go out no faster than the spectator's rate, and only once it has
+// acknowledged the last one, so a slow spectator gets fewer, larger updates rather than a growing backlog. The update for
+// the tick a game is lost in is the exception, and goes out whatever is outstanding
+// known is each orb as the spectator has acknowledged it, and bounced orbs are sent as the difference from it. sent holds
+// the orbs of each outstanding update, oldest first, until its tick comes back. pending lists the orbs whose course has
+// changed since the last update, each marked in changed with how it is to be sent
+
+struct spectator_client {
+    int socket;
+    bool greeted;
+    bool keyframe;
+    long sent_tick;
+    double interval;
+    double next_update;
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    size_t written;
+    std::vector<spectator_orb> known;
+    std::vector<spectator_sent> sent;
+    std::vector<spectator_outstanding> outstanding;
+    std::vector<unsigned char> changed;
+    std::vector<int> pending;
+};
+
+// Streams a game to every spectator that connects to the socket at path. game is the state's game count as of the last
+// update, so that a restart sends everyone a keyframe
+// The server's work each tick is in the orbs that changed course, not the orbs in flight, and only a keyframe, sent to a
+// spectator when it joins or a new game starts, carries every orb
+
+struct spectator_server {
+    const char *path;
+    int listener;
+    long game;
+    long updates;
+    long bytes;
+    std::vector<spectator_client *> clients;
+};
+
+// Listens for spectators at path, replacing a socket left there by an earlier run. Returns false if it cannot
+// The server is driven from the simulation thread between ticks and never blocks it
+
+bool start_spectators(spectator_server *server, const char *path) {
+    server->path = path;
+    server->game = -1;
+    server->updates = 0;
+    server->bytes = 0;
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Error serving spectators at %s: path too long\n", path);
+        return false;
+    };
+    strcpy(address.sun_path, path);
+    struct stat status;
+    if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path);
+    };
+    server->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (server->listener < 0 || bind(server->listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(server->listener, spectator_backlog) != 0) {
+        printf("Error serving spectators at %s\n", path);
+        if (server->listener >= 0) {
+            close(server->listener);
+        };
+        return false;
+    };
+    printf("Serving spectators at %s\n", path);
+    return true;
+};
+
+// Writes as much of the client's output as its socket will take without blocking. Returns false if it has gone
+
+bool flush_spectator(spectator_client *client) {
+    while (client->written < client->out.size()) {
+        ssize_t sent = send(client->socket, client->out.data() + client->written, client->out.size() - client->written,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        };
+        client->written += sent;
+    };
+    client->out.clear();
+    client->written = 0;
+    return true;
+};
+
+// Disconnects every spectator, removes the socket and reports what was sent. Each spectator is given up to
+// spectator_linger_seconds to take what is still to be written, which is usually the update saying the game is over
+
+void stop_spectators(spectator_server *server) {
+    for (spectator_client *client : server->clients) {
+        pollfd writable = {fd : client->socket, events : POLLOUT, revents : 0};
+        double deadline = now_seconds() + spectator_linger_seconds;
+        while (flush_spectator(client) && !client->out.empty() && now_seconds() < deadline) {
+            poll(&writable, 1, 10);
+        };
+        close(client->socket);
+        delete client;
+    };
+    server->clients.clear();
+    close(server->listener);
+    unlink(server->path);
+    printf("Sent %li updates to spectators in %li bytes\n", server->updates, server->bytes);
+};
+
+// Adds orb to the client's pending orbs, to be sent as mark says or whole if it was already marked that way
+
+void mark_orb(spectator_client *client, int orb, unsigned char mark) {
+    if (client->changed[orb] == 0) {
+        client->pending.push_back(orb);
+    };
+    client->changed[orb] = client->changed[orb] > mark ? client->changed[orb] : mark;
+};
+
+// Marks the orbs whose course changed in the tick state has just run for every spectator. Run after every tick
+
+void track_spectators(spectator_server *server, gameState *state) {
+    PROFILE_SCOPE(phase_serve);
+    for (spectator_client *client : server->clients) {
+        if (!client->greeted || client->keyframe) {
+            continue;
+        };
+        for (int i = 0; i < state->respawned; i++) {
+            mark_orb(client, state->objects.respawn[i], orb_whole);
+        };
+        for (int i = state->spawned_from; i < state->object_count; i++) {
+            mark_orb(client, i, orb_whole);
+        };
+        if (state->world.orb_collisions) {
+            for (std::vector<int> &contacts : state->sweep.contacts) {
+                for (int orb : contacts) {
+                    mark_orb(client, orb, orb_bounced);
+                };
+            };
+        };
+    };
+};
+
+// Appends an update bringing the client up to state's latest tick to its output, then forgets the orbs it lists until
+// the client acknowledges it. Bounced orbs are sent as the difference from what the client has acknowledged, so while
+// another update is outstanding every orb is sent whole
+// After the byte count: tick, flags (1 for a keyframe, 2 for game over), the tick length on keyframes, the orb count, the
+// player's position quantised and basis as fractions of 32767, then the orbs. Each orb is the gap in index from the
+// one before, doubled and plus 1 if it is whole, its position either whole or as the difference from the client's
+// prediction, its velocity, and its radius in 1/spectator_radius_scale if it is whole. Values are in native byte order
+
+void encode_update(spectator_server *server, spectator_client *client, gameState *state, bool game_over) {
+    if (client->keyframe) {
+        for (int orb : client->pending) {
+            client->changed[orb] = 0;
+        };
+        client->pending.clear();
+        for (int i = 0; i < state->object_count; i++) {
+            mark_orb(client, i, orb_whole);
+        };
+    } else {
+        std::sort(client->pending.begin(), client->pending.end());
+    };
+    std::vector<unsigned char> *out = &client->out;
+    size_t start = out->size();
+    out->resize(start + sizeof(unsigned int));
+    put_varint(out, state->tick);
+    out->push_back(client->keyframe | game_over << 1);
+    if (client->keyframe) {
+        put_raw(out, &state->tick_seconds, sizeof(float));
+    };
+    put_varint(out, state->object_count);
+    float position[3] = {state->player_x, state->player_y, state->player_z};
+    for (int a = 0; a < 3; a++) {
+        put_signed(out, lrintf(position[a] * spectator_position_scale));
+    };
+    point basis[3] = {state->forward_belief, state->right_belief, state->up_belief};
+    for (int i = 0; i < 3; i++) {
+        short packed[3] = {static_cast<short>(lrintf(basis[i].x * 32767)), static_cast<short>(lrintf(basis[i].y * 32767)),
+                           static_cast<short>(lrintf(basis[i].z * 32767))};
+        put_raw(out, packed, sizeof(packed));
+    };
+    put_varint(out, client->pending.size());
+    orb_storage *objects = &state->objects;
+    bool pipelined = !client->outstanding.empty();
+    int previous = -1;
+    for (int orb : client->pending) {
+        bool whole = client->changed[orb] == orb_whole || pipelined;
+        client->changed[orb] = 0;
+        spectator_orb *known = &client->known[orb];
+        int predicted[3];
+        predict_orb(known, state->tick, state->tick_seconds, predicted);
+        put_varint(out, static_cast<unsigned long long>(orb - previous - 1) << 1 | whole);
+        previous = orb;
+        spectator_sent sent = {orb : orb, course : *known};
+        sent.course.tick = state->tick;
+        float now_at[3] = {objects->x[orb], objects->y[orb], objects->z[orb]};
+        for (int a = 0; a < 3; a++) {
+            sent.course.position[a] = lrintf(now_at[a] * spectator_position_scale);
+            put_signed(out, whole ? sent.course.position[a] : sent.course.position[a] - predicted[a]);
+        };
+        sent.course.velocity[0] = objects->velocity_x[orb];
+        sent.course.velocity[1] = objects->velocity_y[orb];
+        sent.course.velocity[2] = objects->velocity_z[orb];
+        put_raw(out, sent.course.velocity, sizeof(sent.course.velocity));
+        if (whole) {
+            unsigned short radius = lrintf(objects->radius[orb] * spectator_radius_scale);
+            put_raw(out, &radius, sizeof(radius));
+            sent.course.radius = radius / spectator_radius_scale;
+        };
+        client->sent.push_back(sent);
+    };
+    client->outstanding.push_back({tick : state->tick, orbs : client->pending.size()});
+    client->pending.clear();
+    client->keyframe = false;
+    unsigned int length = out->size() - start - sizeof(unsigned int);
+    memcpy(out->data() + start, &length, sizeof(length));
+    server->updates++;
+    server->bytes += out->size() - start;
+};
+
+// Takes whatever the client has sent: first its greeting of magic, version and updates per second, then a tick
+// acknowledged for each update, which makes the orbs of the oldest outstanding update known. Returns false if it has
+// gone, is not a spectator of this version or acknowledges a tick other than the one it was sent
+
+bool read_spectator(spectator_client *client, gameState *state) {
+    unsigned char buffer[256];
+    while (true) {
+        ssize_t got = recv(client->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        };
+        if (got < 0) {
+            break;
+        };
+        client->in.insert(client->in.end(), buffer, buffer + got);
+    };
+    size_t at = 0;
+    unsigned int hello[3];
+    if (!client->greeted && client->in.size() >= sizeof(hello)) {
+        memcpy(hello, client->in.data(), sizeof(hello));
+        if (hello[0] != spectator_magic || hello[1] != spectator_version || hello[2] == 0) {
+            return false;
+        };
+        client->greeted = true;
+        client->interval = 1.0 / hello[2];
+        client->known.resize(state->max_objects);
+        client->changed.assign(state->max_objects, 0);
+        at = sizeof(hello);
+    };
+    for (; client->greeted && client->in.size() - at >= sizeof(unsigned int); at += sizeof(unsigned int)) {
+        unsigned int acknowledged;
+        memcpy(&acknowledged, client->in.data() + at, sizeof(acknowledged));
+        if (client->outstanding.empty() || acknowledged != static_cast<unsigned int>(client->outstanding.front().tick)) {
+            return false;
+        };
+        size_t orbs = client->outstanding.front().orbs;
+        for (size_t i = 0; i < orbs; i++) {
+            client->known[client->sent[i].orb] = client->sent[i].course;
+        };
+        client->sent.erase(client->sent.begin(), client->sent.begin() + orbs);
+        client->outstanding.erase(client->outstanding.begin());
+    };
+    client->in.erase(client->in.begin(), client->in.begin() + at);
+    return true;
+};
+
+// Accepts new spectators, takes their acknowledgements and sends an update to each one that is due one, dropping any
+// that have gone. Run between batches of ticks, after track_spectators has seen every tick in the batch
+
+void serve_spectators(spectator_server *server, gameState *state, bool game_over) {
+    PROFILE_SCOPE(phase_serve);
+    int accepted;
+    while ((accepted = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        spectator_client *client = new spectator_client();
+        client->socket = accepted;
+        client->greeted = false;
+        client->keyframe = true;
+        client->sent_tick = -1;
+        client->next_update = 0;
+        client->written = 0;
+        server->clients.push_back(client);
+    };
+    if (state->games != server->game) {
+        server->game = state->games;
+        for (spectator_client *client : server->clients) {
+            client->keyframe = true;
+        };
+    };
+    double now = now_seconds();
+    for (size_t c = 0; c < server->clients.size();) {
+        spectator_client *client = server->clients[c];
+        bool open = read_spectator(client, state);
+        bool due = client->outstanding.empty() && now >= client->next_update;
+        if (open && client->greeted && (due || game_over) && (client->keyframe || state->tick != client->sent_tick)) {
+            encode_update(server, client, state, game_over);
+            client->sent_tick = state->tick;
+            client->next_update = fmax(client->next_update + client->interval, now);
+        };
+        if (open && flush_spectator(client)) {
+            c++;
+        } else {
+            close(client->socket);
+            delete client;
+            server->clients.erase(server->clients.begin() + c);
+        };
+    };
+};
+
+// A spectator's copy of a game streamed from a spectator_server, with the pose of the update before the latest to
+// move the view smoothly between them, and every orb as last sent. received is when the latest update arrived
+// flown holds where each orb is drawn, moved on a tick at a time the way the server moves it, so that it stays with the
+// server's orb however long it flies where working it out in one step would drift by the server's rounding
+
+struct spectator_view {
+    int socket;
+    std::vector<unsigned char> in;
+    float tick_seconds;
+    long tick;
+    long previous_tick;
+    double received;
+    bool game_over;
+    point position;
+    point previous_position;
+    point basis[3];
+    point previous_basis[3];
+    int object_count;
+    std::vector<spectator_orb> orbs;
+    std::vector<point> flown;
+    long updates;
+    long bytes;
+    long records;
+};
+
+// Connects view to the server at path, asking for at most rate updates a second. Returns false if it cannot
+
+bool connect_spectator(spectator_view *view, const char *path, int rate) {
+    view->tick = -1;
+    view->object_count = 0;
+    view->updates = 0;
+    view->bytes = 0;
+    view->records = 0;
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unsigned int hello[3] = {spectator_magic, spectator_version, static_cast<unsigned int>(max(rate, 1))};
+    view->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (view->socket < 0 || connect(view->socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        send(view->socket, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+        printf("Error connecting to spectate %s\n", path);
+        if (view->socket >= 0) {
+            close(view->socket);
+        };
+        return false;
+    };
+    return true;
+};
+
+// Applies one update encoded by encode_update to view, returning false if it is malformed or out of step
+
+bool apply_update(spectator_view *view, const unsigned char *data, size_t size) {
+    byte_reader reader = {data : data, size : size, at : 0, failed : false};
+    long tick = read_varint(&reader);
+    unsigned char flags;
+    read_raw(&reader, &flags, 1);
+    bool keyframe = flags & 1;
+    if (keyframe) {
+        read_raw(&reader, &view->tick_seconds, sizeof(float));
+    } else if (view->tick < 0) {
+        return false;
+    };
+    unsigned long long count = read_varint(&reader);
+    if (reader.failed || count > static_cast<unsigned long long>(INT32_MAX)) {
+        return false;
+    };
+    view->previous_tick = keyframe ? tick : view->tick;
+    view->previous_position = view->position;
+    float position[3];
+    for (int a = 0; a < 3; a++) {
+        position[a] = read_signed(&reader) / spectator_position_scale;
+    };
+    view->position = {x : position[0], y : position[1], z : position[2]};
+    for (int i = 0; i < 3; i++) {
+        view->previous_basis[i] = view->basis[i];
+        short packed[3];
+        read_raw(&reader, packed, sizeof(packed));
+        view->basis[i] = {x : packed[0] / 32767.0f, y : packed[1] / 32767.0f, z : packed[2] / 32767.0f};
+        normalise(&view->basis[i]);
+    };
+    if (keyframe) {
+        view->previous_position = view->position;
+        for (int i = 0; i < 3; i++) {
+            view->previous_basis[i] = view->basis[i];
+        };
+    };
+    for (long step = keyframe ? tick : view->tick; step < tick; step++) {
+        for (int i = 0; i < view->object_count; i++) {
+            view->flown[i].x += view->orbs[i].velocity[0] * view->tick_seconds;
+            view->flown[i].y += view->orbs[i].velocity[1] * view->tick_seconds;
+            view->flown[i].z += view->orbs[i].velocity[2] * view->tick_seconds;
+        };
+    };
+    view->object_count = count;
+    view->orbs.resize(count);
+    view->flown.resize(count);
+    unsigned long long records = read_varint(&reader);
+    long long orb = -1;
+    for (unsigned long long r = 0; r < records && !reader.failed; r++) {
+        unsigned long long head = read_varint(&reader);
+        orb += (head >> 1) + 1;
+        if (orb >= view->object_count) {
+            return false;
+        };
+        bool whole = head & 1;
+        spectator_orb *known = &view->orbs[orb];
+        int predicted[3];
+        predict_orb(known, tick, view->tick_seconds, predicted);
+        for (int a = 0; a < 3; a++) {
+            long long value = read_signed(&reader);
+            known->position[a] = whole ? value : predicted[a] + value;
+        };
+        read_raw(&reader, known->velocity, sizeof(known->velocity));
+        if (whole) {
+            unsigned short radius;
+            read_raw(&reader, &radius, sizeof(radius));
+            known->radius = radius / spectator_radius_scale;
+        };
+        known->tick = tick;
+        view->flown[orb] = {
+            x : known->position[0] / spectator_position_scale,
+            y : known->position[1] / spectator_position_scale,
+            z : known->position[2] / spectator_position_scale
+        };
+    };
+    view->tick = tick;
+    view->game_over = flags & 2;
+    view->received = now_seconds();
+    view->records += records;
+    return !reader.failed && reader.at == size;
+};
+
+// Applies every update that arrives within wait_ms, acknowledging each one. Returns false once the server has gone
+
+bool pump_spectator(spectator_view *view, int wait_ms) {
+    pollfd ready = {fd : view->socket, events : POLLIN, revents : 0};
+    if (poll(&ready, 1, wait_ms) <= 0) {
+        return true;
+    };
+    unsigned char buffer[65536];
+    while (true) {
+        ssize_t got = recv(view->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        };
+        if (got < 0) {
+            break;
+        };
+        view->in.insert(view->in.end(), buffer, buffer + got);
+    };
+    size_t at = 0;
+    unsigned int length;
+    while (view->in.size() - at >= sizeof(length)) {
+        memcpy(&length, view->in.data() + at, sizeof(length));
+        if (view->in.size() - at - sizeof(length) < length) {
+            break;
+        };
+        if (!apply_update(view, view->in.data() + at + sizeof(length), length)) {
+            printf("Error reading spectator update\n");
+            return false;
+        };
+        unsigned int acknowledged = view->tick;
+        send(view->socket, &acknowledged, sizeof(acknowledged), MSG_NOSIGNAL);
+        view->updates++;
+        view->bytes += sizeof(length) + length;
+        at += sizeof(length) + length;
+    };
+    view->in.erase(view->in.begin(), view->in.begin() + at);
+    return true;
+};
+
+// Fills snapshot from view for a frameRenderer, as of the latest update's tick. The snapshot spans the two latest updates
+// as if they were one tick, so frames move smoothly from the pose of one to the next
+
+void spectator_snapshot(spectator_view *view, world_snapshot *snapshot) {
+    snapshot->tick = view->tick;
+    snapshot->tick_seconds = max(view->tick - view->previous_tick, 1) * view->tick_seconds;
+    snapshot->time = view->received;
+    snapshot->start_time = view->received - view->tick * view->tick_seconds;
+    snapshot->game_over = view->game_over;
+    snapshot->loss_reason = NULL;
+    snapshot->position = view->position;
+    snapshot->previous_position = view->previous_position;
+    for (int i = 0; i < 3; i++) {
+        snapshot->basis[i] = view->basis[i];
+        snapshot->previous_basis[i] = view->previous_basis[i];
+    };
+    int count = view->object_count;
+    std::vector<float> *fields[] = {&snapshot->x, &snapshot->y, &snapshot->z, &snapshot->velocity_x,
+                                    &snapshot->velocity_y, &snapshot->velocity_z, &snapshot->radius};
+    for (std::vector<float> *field : fields) {
+        field->resize(count);
+    };
+    snapshot->indices.resize(count);
+    for (int i = 0; i < count; i++) {
+        spectator_orb *orb = &view->orbs[i];
+        snapshot->indices[i] = i;
+        snapshot->x[i] = view->flown[i].x;
+        snapshot->y[i] = view->flown[i].y;
+        snapshot->z[i] = view->flown[i].z;
+        snapshot->velocity_x[i] = orb->velocity[0];
+        snapshot->velocity_y[i] = orb->velocity[1];
+        snapshot->velocity_z[i] = orb->velocity[2];
+        snapshot->radius[i] = orb->radius;
+    };
+};
+
+// Prints how much the spectator has been sent
+
+void report_spectator(spectator_view *view) {
+    printf("Watched %li updates up to tick %li of %i orbs: %.0f bytes and %.1f orbs per update, %li bytes in all\n",
+           view->updates, view->tick, view->object_count, view->bytes / fmax(view->updates, 1),
+           view->records / fmax(view->updates, 1), view->bytes);
+};
+
+// Watches the game served at path without a window until the server goes, reporting what was sent once a second
+
+void watch_headless(const char *path, int rate) {
+    spectator_view view;
+    if (!connect_spectator(&view, path, rate)) {
+        return;
+    };
+    double reported = now_seconds();
+    while (pump_spectator(&view, 100)) {
+        if (now_seconds() - reported >= 1.0) {
+            report_spectator(&view);
+            reported = now_seconds();
+        };
+    };
+    report_spectator(&view);
+    close(view.socket);
+};
+
+// Runs the simulation on its own thread until running is cleared, publishing a snapshot after each batch of ticks
+// Ticks are a fixed tick_seconds however long frames take, catching up by at most max_catch_up_ticks at once so that a
+// stall slows the game down rather than freezing it in a burst of updates. Input is applied between ticks, each tick
+// taking only the events that happened before it was due, so a burst of catch up ticks still turns the player in the
+// tick each key changed in rather than all at the first
+// Each restart plays a new world, seeded from the first game's seed and the number of games so far, unless the games
+// start from a saved world, which brings its own seed
+// If recording is not NULL each game is recorded to it, and saved when the game is lost or the user quits. If
+// spectators is not NULL the game is streamed to its spectators between batches of ticks
+
+void run_simulation(gameState *state, input_queue *inputs, snapshot_exchange *exchange, std::atomic<bool> *running,
+                    input_recording *recording, spectator_server *spectators) {
+    bool game_over = false;
+    unsigned int first_seed = state->seed;
+    if (recording != NULL) {
+        start_recording(recording, state);
+    };
+    double previous = now_seconds();
+    double accumulator = 0;
+    state->take_snapshot(back_snapshot(exchange), game_over, previous);
+    publish_snapshot(exchange);
+    while (running->load()) {
+        double now = now_seconds();
+        accumulator += now - previous;
+        previous = now;
+        int ticks = 0;
+        bool restarted = false;
+        input_event event;
+        while (peek_input(inputs, &event) && (game_over || event.time <= now - accumulator)) {
+            pop_input(inputs, &event);
+            if (event.key != key_restart) {
+                apply_input(state, &event);
+            } else if (game_over) {
+                state->seed = static_cast<unsigned int>(mix_bits(first_seed + state->games));
+                state->initialise();
+                game_over = false;
+                restarted = true;
+                accumulator = 0;
+                if (recording != NULL) {
+                    start_recording(recording, state);
+                };
+            };
+        };
+        while (accumulator >= state->tick_seconds && ticks < max_catch_up_ticks && !game_over) {
+            state->update(&game_over);
+            if (recording != NULL) {
+                record_tick(recording, state);
+            };
+            if (spectators != NULL) {
+                track_spectators(spectators, state);
+            };
+            accumulator -= state->tick_seconds;
+            ticks++;
+            while (!game_over && peek_input(inputs, &event) && event.time <= now - accumulator) {
+                pop_input(inputs, &event);
+                apply_input(state, &event);
+            };
+        };
+        if (ticks == max_catch_up_ticks) {
+            accumulator = fmin(accumulator, state->tick_seconds);
+        };
+        if (game_over && ticks > 0) {
+            std::cout << state->loss_reason << "\n";
+            if (recording != NULL) {
+                save_recording(recording);
+            };
+        };
+        if (ticks > 0 || restarted) {
+            state->take_snapshot(back_snapshot(exchange), game_over, now - accumulator);
+            publish_snapshot(exchange);
+        };
+        if (spectators != NULL) {
+            serve_spectators(spectators, state, game_over);
+        };
+        double wait = game_over ? state->tick_seconds : state->tick_seconds - accumulator;
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
         };
-        float player_velocity;
-        flying_object objects[scenario_max_objects];
-        int object_count;
     };
+    if (recording != NULL && !game_over) {
+        save_recording(recording);
+    };
+};
 
-    // Handles relevant user key presses and discards non-relevant ones from event stack
+#ifndef HEADLESS
 
-    void handle_event(gameState* state, bool* game_over, bool* restarted) {
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    exit(0);
-                    break;
-                case SDL_KEYDOWN:
-                    switch (event.key.keysym.scancode) {
-                        case SDL_SCANCODE_SPACE:
-                            state->accelerating = true;
-                            break;
-                        case SDL_SCANCODE_UP:
-                            state->turning_up = true;
-                            break;
-                        case SDL_SCANCODE_DOWN:
-                            state->turning_down = true;
-                            break;
-                        case SDL_SCANCODE_LEFT:
-                            state->turning_left = true;
-                            break;
-                        case SDL_SCANCODE_RIGHT:
-                            state->turning_right = true;
-                            break;
-                        case SDL_SCANCODE_RETURN:
-                            if (*game_over) {
-                                *game_over = false;
-                                *restarted = true;
-                            };
-                            break;
-                        case SDL_SCANCODE_ESCAPE:
-                            printf("Exiting program");
-                            exit(0);
-                        default:
-                            break;
+// The turning keys as the render thread last saw them, indexed from key_left, and when each last went down or up, so
+// that frames can turn the view as far as the simulation is about to before a tick shows it
+// changed is when the oldest key change not yet in a presented frame happened, or 0 if every change has been shown
+
+struct input_latch {
+    bool held[4];
+    double since[4];
+    double changed;
+};
+
+// Turns basis on from the pose the simulation had at time from to now by the turning keys held in latch, the way the
+// simulation will turn it over its next ticks of tick_seconds. At most latch_max_seconds is added in case the simulation
+// has stalled. Like update, each tick yaws and then pitches, so a diagonal turn ends where the next ticks will put it
+
+void latch_turn(input_latch *latch, point *basis, double from, double now, float tick_seconds) {
+    float held[4];
+    for (int k = 0; k < 4; k++) {
+        held[k] = latch->held[k] ? fmin(fmax(now - fmax(latch->since[k], from), 0.0), latch_max_seconds) : 0.0f;
+    };
+    float yaw = held[key_right - key_left] - held[0];
+    float pitch = held[key_down - key_left] - held[key_up - key_left];
+    float yaw_left = fabs(yaw);
+    float pitch_left = fabs(pitch);
+    while (yaw_left > 0 || pitch_left > 0) {
+        float yaw_step = fmin(yaw_left, tick_seconds);
+        float pitch_step = fmin(pitch_left, tick_seconds);
+        turn_basis(&basis[0], &basis[1], &basis[2], (yaw > 0) - (yaw < 0), 0, angular_thruster_power * yaw_step);
+        turn_basis(&basis[0], &basis[1], &basis[2], 0, (pitch > 0) - (pitch < 0), angular_thruster_power * pitch_step);
+        yaw_left -= yaw_step;
+        pitch_left -= pitch_step;
+    };
+};
+
+// Draws the snapshots the simulation thread publishes, with its own working space so that it shares nothing with it
+// If latch is set the view's orientation is late latched from the keys held as the frame starts, and the time from each
+// key change to the first frame presented after it is kept, and written to latency_log if that is open. If launched is
+// set, how long after it the first frame was presented is printed
+
+class frameRenderer {
+    public:
+        bool show_profile = false;
+        thread_pool *raster_pool = NULL;
+        input_latch *latch = NULL;
+        FILE *latency_log = NULL;
+        double launched = 0;
+
+        // Renders everything for a frame from snapshot, placed as far towards the next tick as time has gone
+        // Returns how long the frame took before presenting
+
+        double render(SDL_Renderer* renderer, SDL_Window* window, SDL_Color* colour, world_snapshot *snapshot) {
+            double now = now_seconds();
+            double shown = latch != NULL ? latch->changed : 0;
+            SDL_RenderClear(renderer);
+            int h;
+            int w;
+            SDL_GetWindowSize(window, &w, &h);
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+            if (atlas.texture == NULL && !build_atlas(&atlas, renderer)) {
+                printf("Error building HUD glyph atlas: %s\n", SDL_GetError());
+            };
+            clear_batch(&batch);
+            batch.white = atlas.white;
+            SDL_Color tint = {colour->r, colour->g, colour->b, 255};
+            if (snapshot->tick >= 0) {
+                float alpha = snapshot->game_over ? 1.0f : fmin(fmax((now - snapshot->time) / snapshot->tick_seconds, 0.0), 1.0);
+                int visible_count = view_snapshot(snapshot, alpha, now, h, w);
+                {
+                    PROFILE_SCOPE(phase_sort);
+                    sort_draw_order(&draw, order.data(), visible_count);
+                };
+                if (raster_pool != NULL) {
+                    PROFILE_SCOPE(phase_raster);
+                    draw_software(renderer, visible_count, h, w);
+                } else {
+                    PROFILE_SCOPE(phase_batch);
+                    for (int i = 0; i < visible_count; i++) {
+                        batch_disc(&batch, order[i].x, order[i].y, order[i].radius);
                     };
+                };
+                if (atlas.texture != NULL) {
+                    PROFILE_SCOPE(phase_hud);
+                    char buffer[64];
+                    snprintf(buffer, 64, "x: %f | y: %f | z: %f", snapshot->position.x, snapshot->position.y, snapshot->position.z);
+                    layout_line(&hud[0], &atlas, buffer, true, 0, 0, tint);
+                    double alive = (snapshot->game_over ? snapshot->time : now) - snapshot->start_time;
+                    snprintf(buffer, 64, "Seconds alive: %li", static_cast<long>(alive));
+                    layout_line(&hud[1], &atlas, buffer, false, w, 0, tint);
+                    batch_line(&batch, &hud[0]);
+                    batch_line(&batch, &hud[1]);
+                };
+            };
+#ifdef PROFILE
+            if (show_profile && atlas.texture != NULL) {
+                batch_profile(now, tint);
+            };
+#endif
+            {
+                PROFILE_SCOPE(phase_submit);
+                submit_batch(&batch, renderer, atlas.texture);
+            };
+            double work = now_seconds() - now;
+            {
+                PROFILE_SCOPE(phase_present);
+                SDL_RenderPresent(renderer);
+            };
+            if (launched > 0) {
+                printf("First frame presented %.1f ms after launch\n", (now_seconds() - launched) * 1000);
+                launched = 0;
+            };
+            if (shown > 0) {
+                double latency = now_seconds() - shown;
+                latencies.push_back(latency);
+                if (latency_log != NULL) {
+                    fprintf(latency_log, "%.6f,%.3f\n", shown, latency * 1000);
+                };
+                latch->changed = 0;
+            };
+            return work;
+        };
+
+        // Prints the spread of input to present latency over every key change shown so far
+
+        void report_latency() {
+            if (latencies.empty()) {
+                return;
+            };
+            std::vector<double> sorted = latencies;
+            std::sort(sorted.begin(), sorted.end());
+            size_t count = sorted.size();
+            printf("Input to present latency over %zu key changes: p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", count,
+                   sorted[count / 2] * 1000, sorted[count * 95 / 100] * 1000, sorted[count - 1] * 1000);
+        };
+
+    private:
+        geometry_batch batch;
+        glyph_atlas atlas = {};
+        hud_line hud[2] = {};
+        draw_order draw;
+        std::vector<view_orb> order;
+        framebuffer software = {};
+        SDL_Texture *canvas = NULL;
+        std::vector<double> latencies;
+#ifdef PROFILE
+        profile_stats stats = {};
+        double stats_time = 0;
+        hud_line profile_lines[profile_phases + 1] = {};
+#endif
+
+        // Projects the snapshot's orbs for a window of the given size into order, unsorted, returning the number in view
+        // With a latch the orientation is the latest tick's turned on to now rather than one between the last two ticks
+
+        int view_snapshot(world_snapshot *snapshot, float alpha, double now, int h, int w) {
+            PROFILE_SCOPE(phase_view);
+            point player;
+            point basis[3];
+            interpolate_pose(&snapshot->previous_position, snapshot->previous_basis, &snapshot->position, snapshot->basis,
+                             alpha, &player, basis);
+            if (latch != NULL && !snapshot->game_over) {
+                for (int i = 0; i < 3; i++) {
+                    basis[i] = snapshot->basis[i];
+                };
+                latch_turn(latch, basis, snapshot->time, now, snapshot->tick_seconds);
+            };
+            view_basis view;
+            build_view(&view, &player, &basis[0], &basis[1], &basis[2], h, w);
+            orb_storage orbs = {};
+            orbs.x = snapshot->x.data();
+            orbs.y = snapshot->y.data();
+            orbs.z = snapshot->z.data();
+            orbs.velocity_x = snapshot->velocity_x.data();
+            orbs.velocity_y = snapshot->velocity_y.data();
+            orbs.velocity_z = snapshot->velocity_z.data();
+            orbs.radius = snapshot->radius.data();
+            order.resize(snapshot->indices.size());
+            return transform_orbs(&view, &orbs, snapshot->indices.data(), snapshot->indices.size(),
+                                  (1.0f - alpha) * snapshot->tick_seconds, order.data());
+        };
+
+        // Draws this frame's sorted orbs on the CPU with the tiles split across raster_pool and copies them to the window
+        // The HUD is still batched, and drawn over them when the batch is submitted
+
+        void draw_software(SDL_Renderer *renderer, int visible_count, int h, int w) {
+            if (canvas == NULL || software.w != w || software.h != h) {
+                if (canvas != NULL) {
+                    SDL_DestroyTexture(canvas);
+                };
+                resize_framebuffer(&software, w, h);
+                canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, w, h);
+                if (canvas == NULL) {
+                    printf("Error creating software frame texture: %s\n", SDL_GetError());
+                    return;
+                };
+            };
+            raster_frame(&software, order.data(), visible_count, raster_pool);
+            SDL_UpdateTexture(canvas, NULL, software.pixels.data(), w * sizeof(unsigned int));
+            SDL_RenderCopy(renderer, canvas, NULL, NULL);
+        };
+
+#ifdef PROFILE
+
+        // Adds a table of each phase's recent percentiles below the HUD, working them out afresh every profile_refresh_seconds
+
+        void batch_profile(double now, SDL_Color tint) {
+            if (now - stats_time >= profile_refresh_seconds) {
+                summarise_profile(&stats, profile_window_seconds);
+                stats_time = now;
+            };
+            char buffer[64];
+            int top = atlas.line_height;
+            snprintf(buffer, 64, "%-10s %8s %8s %8s  ms", "phase", "p50", "p95", "p99");
+            layout_line(&profile_lines[0], &atlas, buffer, true, 0, top, tint);
+            batch_line(&batch, &profile_lines[0]);
+            for (int phase = 0; phase < profile_phases; phase++) {
+                if (stats.counts[phase] == 0) {
+                    continue;
+                };
+                top += atlas.line_height;
+                snprintf(buffer, 64, "%-10s %8.3f %8.3f %8.3f", profile_phase_names[phase], stats.p50[phase], stats.p95[phase], stats.p99[phase]);
+                layout_line(&profile_lines[phase + 1], &atlas, buffer, true, 0, top, tint);
+                batch_line(&batch, &profile_lines[phase + 1]);
+            };
+        };
+
+#endif
+};
+
+// Passes a turning key going down or up at time on to the simulation and notes it in latch
+
+void turn_key(input_queue *inputs, input_latch *latch, input_key key, bool pressed, double time) {
+    push_input(inputs, {key, pressed, time});
+    latch->held[key - key_left] = pressed;
+    latch->since[key - key_left] = time;
+    if (latch->changed == 0) {
+        latch->changed = time;
+    };
+};
+
+// Passes relevant user key presses on to the simulation and discards non-relevant ones from event stack
+// Each press is stamped with when SDL received it, and turning keys are also noted in latch. F3 flips show_profile
+// Returns false once the user has asked to quit
+
+bool handle_event(input_queue *inputs, input_latch *latch, bool *show_profile) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return false;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP: {
+                bool pressed = event.type == SDL_KEYDOWN;
+                if (event.key.repeat) {
                     break;
-                case SDL_KEYUP:
-                    switch (event.key.keysym.scancode) {
-                        case SDL_SCANCODE_SPACE:
-                            state->accelerating = false;
-                            break;
-                        case SDL_SCANCODE_UP:
-                            state->turning_up = false;
-                            break;
-                        case SDL_SCANCODE_DOWN:
-                            state->turning_down = false;
-                            break;
-                        case SDL_SCANCODE_LEFT:
-                            state->turning_left = false;
-                            break;
-                        case SDL_SCANCODE_RIGHT:
-                            state->turning_right = false;
-                            break;
-                        default:
-                            break;
+                };
+                // SDL stamps events in whole milliseconds since it started, so the stamp is moved onto the same clock as
+                // now_seconds by how long ago it was
+                double time = now_seconds() - (SDL_GetTicks() - event.key.timestamp) / 1000.0;
+                switch (event.key.keysym.scancode) {
+                    case SDL_SCANCODE_SPACE:
+                        push_input(inputs, {key_accelerate, pressed, time});
+                        break;
+                    case SDL_SCANCODE_UP:
+                        turn_key(inputs, latch, key_up, pressed, time);
+                        break;
+                    case SDL_SCANCODE_DOWN:
+                        turn_key(inputs, latch, key_down, pressed, time);
+                        break;
+                    case SDL_SCANCODE_LEFT:
+                        turn_key(inputs, latch, key_left, pressed, time);
+                        break;
+                    case SDL_SCANCODE_RIGHT:
+                        turn_key(inputs, latch, key_right, pressed, time);
+                        break;
+                    case SDL_SCANCODE_RETURN:
+                        if (pressed) {
+                            push_input(inputs, {key_restart, true, time});
+                        };
+                        break;
+                    case SDL_SCANCODE_F3:
+                        *show_profile = pressed ? !*show_profile : *show_profile;
+                        break;
+                    case SDL_SCANCODE_ESCAPE:
+                        if (pressed) {
+                            printf("Exiting program\n");
+                            return false;
+                        };
+                        break;
+                    default:
+                        break;
+                };
+                break;
+            };
+            default:
+                break;
+        };
+    };
+    return true;
+};
+
+#endif
+
+// One step of a scripted input sequence, holding the given keys for a number of ticks
+
+struct input_step {
+    int ticks;
+    bool accelerating;
+    bool turning_left;
+    bool turning_right;
+    bool turning_up;
+    bool turning_down;
+};
+
+// Default script for headless runs, loosely circling the centre of the box so the player stays among the orbs
+
+const input_step default_script[] = {
+    {10, true, false, false, false, false},
+    {30, false, true, false, false, false},
+    {40, false, false, false, true, false},
+    {60, false, false, false, false, false},
+    {30, false, false, true, false, false},
+    {40, false, false, false, false, true},
+};
+
+// Sets the input flags of the state to those the script holds at a given tick, looping the script forever
+
+void apply_script(gameState *state, const input_step *script, int steps, long tick) {
+    long length = 0;
+    for (int i = 0; i < steps; i++) {
+        length += script[i].ticks;
+    };
+    long position = tick % length;
+    int i = 0;
+    while (position >= script[i].ticks) {
+        position -= script[i].ticks;
+        i++;
+    };
+    state->accelerating = script[i].accelerating;
+    state->turning_left = script[i].turning_left;
+    state->turning_right = script[i].turning_right;
+    state->turning_up = script[i].turning_up;
+    state->turning_down = script[i].turning_down;
+};
+
+// Steers a game in place of a player by setting its input flags before each tick
+
+typedef void (*autopilot_policy)(gameState *state);
+
+// Plays the default script
+
+void steer_script(gameState *state) {
+    apply_script(state, default_script, sizeof(default_script) / sizeof(input_step), state->tick);
+};
+
+// Sits still
+
+void steer_idle(gameState *state) {
+    set_input_flags(state, 0);
+};
+
+// Cruises at autopilot_cruise_speed, turning away from the orb that will come closest soonest within
+// autopilot_horizon seconds, and back towards the centre when the wall is within that time ahead
+
+void steer_avoid(gameState *state) {
+    set_input_flags(state, 0);
+    state->accelerating = state->player_velocity < autopilot_cruise_speed;
+    point position = {state->player_x, state->player_y, state->player_z};
+    point forward = state->forward_belief;
+    float reach = state->player_velocity * autopilot_horizon;
+    point ahead = {position.x + forward.x * reach, position.y + forward.y * reach, position.z + forward.z * reach};
+    point steer_to = {0, 0, 0};
+    if (out_of_bounds(&state->world.low, &state->world.high, ahead.x, ahead.y, ahead.z, 0)) {
+        steer_to = {
+            x : (state->world.low.x + state->world.high.x) / 2 - position.x,
+            y : (state->world.low.y + state->world.high.y) / 2 - position.y,
+            z : (state->world.low.z + state->world.high.z) / 2 - position.z
+        };
+    } else {
+        spatial_grid *grid = &state->grid;
+        orb_storage *orbs = &state->objects;
+        float margin = grid->reach + autopilot_margin;
+        int low[3] = {grid_coordinate(grid, fmin(position.x, ahead.x) - margin, grid->low.x),
+                      grid_coordinate(grid, fmin(position.y, ahead.y) - margin, grid->low.y),
+                      grid_coordinate(grid, fmin(position.z, ahead.z) - margin, grid->low.z)};
+        int high[3] = {grid_coordinate(grid, fmax(position.x, ahead.x) + margin, grid->low.x),
+                       grid_coordinate(grid, fmax(position.y, ahead.y) + margin, grid->low.y),
+                       grid_coordinate(grid, fmax(position.z, ahead.z) + margin, grid->low.z)};
+        float soonest = autopilot_horizon;
+        for (int cx = low[0]; cx <= high[0]; cx++) {
+            for (int cy = low[1]; cy <= high[1]; cy++) {
+                for (int cz = low[2]; cz <= high[2]; cz++) {
+                    for (int i = grid->first[(cx * grid->cells_per_axis + cy) * grid->cells_per_axis + cz]; i >= 0; i = grid->next[i]) {
+                        point offset = {orbs->x[i] - position.x, orbs->y[i] - position.y, orbs->z[i] - position.z};
+                        point closing = {
+                            x : orbs->velocity_x[i] - forward.x * state->player_velocity,
+                            y : orbs->velocity_y[i] - forward.y * state->player_velocity,
+                            z : orbs->velocity_z[i] - forward.z * state->player_velocity
+                        };
+                        float speed_squared = closing.x * closing.x + closing.y * closing.y + closing.z * closing.z;
+                        float when = speed_squared > 0 ? -(offset.x * closing.x + offset.y * closing.y + offset.z * closing.z) / speed_squared : 0;
+                        when = fmax(when, 0.0f);
+                        if (when >= soonest) {
+                            continue;
+                        };
+                        point nearest = {offset.x + closing.x * when, offset.y + closing.y * when, offset.z + closing.z * when};
+                        float clearance = orbs->radius[i] + autopilot_margin;
+                        if (nearest.x * nearest.x + nearest.y * nearest.y + nearest.z * nearest.z < clearance * clearance) {
+                            soonest = when;
+                            steer_to = {-nearest.x, -nearest.y, -nearest.z};
+                        };
                     };
-                    break;
-                default:
-                    break;
+                };
             };
         };
+    };
+    // Turning right swings forward towards right, and turning up swings it away from up. A target straight behind is
+    // turned towards to the right
+    float along = steer_to.x * forward.x + steer_to.y * forward.y + steer_to.z * forward.z;
+    float across = steer_to.x * state->right_belief.x + steer_to.y * state->right_belief.y + steer_to.z * state->right_belief.z;
+    float upward = steer_to.x * state->up_belief.x + steer_to.y * state->up_belief.y + steer_to.z * state->up_belief.z;
+    if (along < 0 && fabs(across) + fabs(upward) < -along * 0.1f) {
+        across = -along;
+    };
+    if (fabs(across) >= fabs(upward) && across != 0) {
+        state->turning_right = across > 0;
+        state->turning_left = across < 0;
+    } else if (upward != 0) {
+        state->turning_down = upward > 0;
+        state->turning_up = upward < 0;
+    };
+};
+
+// A named autopilot policy
+
+struct autopilot {
+    const char *name;
+    autopilot_policy steer;
+};
+
+const autopilot autopilots[] = {
+    {"script", steer_script},
+    {"idle", steer_idle},
+    {"avoid", steer_avoid},
+};
+
+// Returns the autopilot called name, or NULL if there is none
+
+const autopilot *find_autopilot(const char *name) {
+    for (const autopilot &pilot : autopilots) {
+        if (strcmp(pilot.name, name) == 0) {
+            return &pilot;
+        };
+    };
+    return NULL;
 };
 
-// Returns the minimum of 2 integers
+// Draws the latest tick of state into frame on the CPU, splitting the tiles across pool, with alive as the HUD's time
 
-int min(int a, int b) {
-    return a > b ? b : a;
+void render_software(gameState *state, framebuffer *frame, thread_pool *pool, double alive) {
+    int visible_count = state->view_frame(frame->h, frame->w);
+    sort_draw_order(&state->draw, state->order.data(), visible_count);
+    raster_frame(frame, state->order.data(), visible_count, pool);
+    char buffer[64];
+    snprintf(buffer, 64, "x: %f | y: %f | z: %f", state->player_x, state->player_y, state->player_z);
+    raster_text(frame, buffer, true, 0, 0, raster_hud_colour);
+    snprintf(buffer, 64, "Seconds alive: %li", static_cast<long>(alive));
+    raster_text(frame, buffer, false, frame->w, 0, raster_hud_colour);
+};
+
+// Frames of a game without a window, drawn on the CPU every every ticks and written to directory as PPM images
+// If directory is NULL the frames are only hashed. hash combines every frame drawn so far, for golden image checks
+
+struct frame_dump {
+    const char *directory;
+    int every;
+    int size;
+    long start_tick;
+    long drawn;
+    unsigned long long hash;
+    framebuffer buffer;
 };
 
+// Draws the tick state has just run if it is one of the frames to keep, counting time alive from the first tick seen
+// Returns false if the frame could not be written
+
+bool dump_frame(frame_dump *frames, gameState *state) {
+    if (frames->start_tick < 0) {
+        frames->start_tick = state->tick - 1;
+        resize_framebuffer(&frames->buffer, frames->size, frames->size);
+    };
+    long ticks = state->tick - frames->start_tick;
+    if (ticks % frames->every != 0) {
+        return true;
+    };
+    render_software(state, &frames->buffer, state->pool, ticks * state->tick_seconds);
+    frames->hash = (frames->hash ^ frame_hash(&frames->buffer)) * 1099511628211ULL;
+    frames->drawn++;
+    if (frames->directory == NULL) {
+        return true;
+    };
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%06li.ppm", frames->directory, state->tick);
+    return save_ppm(&frames->buffer, path);
+};
+
+// Reports how many frames were drawn and the hash of all of them
+
+void report_frames(frame_dump *frames) {
+    printf("Drew %li frames of %ix%i on the CPU", frames->drawn, frames->size, frames->size);
+    if (frames->directory != NULL) {
+        printf(" to %s", frames->directory);
+    };
+    printf(", frame hash: %016llx\n", frames->hash);
+};
+
+// Runs a single game without a window as fast as possible, played by pilot, stopping at game over or after max_ticks
+// If recording is not NULL the game is recorded to it and saved at the end. If prewarmed is not NULL the game starts
+// from that world. If frames is not NULL the game's frames are drawn on the CPU as it goes. If spectators is not NULL the
+// game is streamed to them, with ticks run in real time so that there is something to watch
+
+void run_headless(unsigned int seed, long max_ticks, float tick_seconds, scenario *world, thread_pool *pool, input_recording *recording,
+                  world_file *prewarmed, const autopilot *pilot, frame_dump *frames, spectator_server *spectators) {
+    gameState *state = new gameState(*world);
+    state->seed = seed;
+    state->pool = pool;
+    state->tick_seconds = tick_seconds;
+    state->prewarmed = prewarmed;
+    state->initialise();
+    if (recording != NULL) {
+        start_recording(recording, state);
+    };
+    bool game_over = false;
+    long tick = 0;
+    auto begin = std::chrono::steady_clock::now();
+    while (!game_over && tick < max_ticks) {
+        pilot->steer(state);
+        state->update(&game_over);
+        if (recording != NULL) {
+            record_tick(recording, state);
+        };
+        tick++;
+        if (frames != NULL && !dump_frame(frames, state)) {
+            break;
+        };
+        if (spectators != NULL) {
+            track_spectators(spectators, state);
+            serve_spectators(spectators, state, game_over);
+            double ahead = tick * tick_seconds - std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (ahead > 0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(ahead));
+            };
+        };
+    };
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (game_over) {
+        std::cout << state->loss_reason << "\n";
+    };
+    printf("Survived %li ticks (%.2f seconds of game time) in %.3f seconds\n", tick, tick * tick_seconds, seconds);
+    printf("State hash: %016llx\n", state->state_hash());
+    if (recording != NULL && save_recording(recording)) {
+        printf("Recorded %li ticks in %zu bytes of input to %s\n", tick, recording->events.size(), recording->path);
+    };
+    if (frames != NULL) {
+        report_frames(frames);
+    };
+    delete state;
+};
+
+// Runs games independent games as fast as possible across the pool, each with its own seed counting up from seed and
+// played by pilot until game over or max_ticks, then reports the throughput and how long the games lasted
+// Each thread reuses one game's storage for a run of batch_chunk games, so the batch allocates almost nothing
+
+void run_batch(unsigned int seed, int games, long max_ticks, float tick_seconds, scenario *world, thread_pool *pool,
+               world_file *prewarmed, const autopilot *pilot) {
+    std::vector<long> survived(games);
+    std::vector<const char *> reasons(games);
+    auto begin = std::chrono::steady_clock::now();
+    pool->parallel_for(games, batch_chunk, [&](int start, int end) {
+        gameState *state = new gameState(*world);
+        state->tick_seconds = tick_seconds;
+        state->prewarmed = prewarmed;
+        for (int game = start; game < end; game++) {
+            state->initialise();
+            state->seed = seed + game;
+            bool game_over = false;
+            long tick = 0;
+            while (!game_over && tick < max_ticks) {
+                pilot->steer(state);
+                state->update(&game_over);
+                tick++;
+            };
+            survived[game] = tick;
+            reasons[game] = game_over ? state->loss_reason : NULL;
+        };
+        delete state;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long total = 0;
+    int to_orbs = 0;
+    int to_bounds = 0;
+    for (int game = 0; game < games; game++) {
+        total += survived[game];
+        to_orbs += reasons[game] == lost_to_orb;
+        to_bounds += reasons[game] == lost_to_bounds;
+    };
+    printf("Ran %i games with the %s autopilot on %i threads in %.3f seconds\n", games, pilot->name, pool->size, seconds);
+    printf("%.1f games/sec, %.1f games/sec per thread, %.0f ticks/sec\n", games / seconds, games / seconds / pool->size, total / seconds);
+    std::vector<long> sorted = survived;
+    std::sort(sorted.begin(), sorted.end());
+    printf("Seconds alive: mean %.2f, p10 %.2f, median %.2f, p90 %.2f, max %.2f\n", total * tick_seconds / games,
+           sorted[games / 10] * tick_seconds, sorted[games / 2] * tick_seconds, sorted[games * 9 / 10] * tick_seconds,
+           sorted[games - 1] * tick_seconds);
+    printf("Lost to orbs %i, lost to the wall %i, still alive after %.0f seconds %i\n", to_orbs, to_bounds, max_ticks * tick_seconds,
+           games - to_orbs - to_bounds);
+    long width = (sorted[games - 1] + batch_histogram_buckets) / batch_histogram_buckets;
+    std::vector<int> buckets(batch_histogram_buckets, 0);
+    for (long ticks : survived) {
+        buckets[min(static_cast<int>(ticks / width), batch_histogram_buckets - 1)]++;
+    };
+    int tallest = *std::max_element(buckets.begin(), buckets.end());
+    printf("%19s %8s\n", "seconds alive", "games");
+    for (int b = 0; b < batch_histogram_buckets; b++) {
+        std::string bar(buckets[b] * batch_histogram_width / tallest, '#');
+        printf("%8.2f - %8.2f %8i %s\n", b * width * tick_seconds, (b + 1) * width * tick_seconds, buckets[b], bar.c_str());
+    };
+};
+
+// Replays a recording as fast as possible, checking the state after every tick against the recorded hash
+// prewarmed must be the world the recording started from, if any. frame, if set, is called after every tick to draw it
+// Returns false if the replay diverged from the recording
+
+bool run_replay(input_recording *recording, thread_pool *pool, world_file *prewarmed, std::function<void(gameState *)> frame) {
+    if (recording->world_hash != (prewarmed != NULL ? prewarmed->header->hash : 0)) {
+        printf("Error: the recording started from a different world. Pass the world it was recorded in with --world\n");
+        return false;
+    };
+    gameState *state = new gameState(recording->world);
+    state->seed = recording->seed;
+    state->pool = pool;
+    state->prewarmed = prewarmed;
+    state->tick_seconds = recording->tick_seconds;
+    state->initialise();
+    replay_cursor cursor = {0, 0, 0};
+    next_change(recording, &cursor);
+    bool game_over = false;
+    long diverged = -1;
+    long tick = 0;
+    auto begin = std::chrono::steady_clock::now();
+    while (tick < recording->ticks && diverged < 0) {
+        while (cursor.next_change == tick) {
+            set_input_flags(state, cursor.flags);
+            next_change(recording, &cursor);
+        };
+        state->update(&game_over);
+        unsigned long long hash = state->state_hash();
+        if (static_cast<unsigned int>(hash ^ hash >> 32) != recording->hashes[tick] || (game_over && tick + 1 < recording->ticks)) {
+            diverged = tick;
+        };
+        if (frame) {
+            frame(state);
+        };
+        tick++;
+    };
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("Replayed %li of %li ticks in %.3f seconds (%.0f ticks/sec)\n", tick, recording->ticks, seconds, tick / seconds);
+    if (diverged >= 0) {
+        printf("Replay diverged from the recording at tick %li\n", diverged);
+    } else {
+        if (game_over) {
+            std::cout << state->loss_reason << "\n";
+        };
+        printf("Replay matches the recording\n");
+    };
+    delete state;
+    return diverged < 0;
+};
+
+// Measures the cost of gameState::update at increasing orb counts, starting each run from a fully populated world
+// Game over is ignored so every run covers the same number of ticks. If prewarmed is not NULL only that world is measured
+
+void run_benchmark(unsigned int seed, thread_pool *pool, world_file *prewarmed) {
+    const int counts[] = {scenario_max_objects, 4096, 32768, 262144, 1048576};
+    std::vector<scenario> worlds;
+    if (prewarmed != NULL) {
+        worlds.push_back(prewarmed->header->world);
+    } else {
+        for (int count : counts) {
+            worlds.push_back(default_scenario(count));
+        };
+    };
+    printf("Simulation on %i threads\n", pool->size);
+    printf("%10s %10s %14s %14s %12s\n", "orbs", "ticks", "ns/tick", "ticks/sec", "ns/orb");
+    for (scenario &world : worlds) {
+        gameState *state = new gameState(world);
+        state->seed = seed;
+        state->pool = pool;
+        state->prewarmed = prewarmed;
+        state->initialise();
+        state->populate(world.max_objects);
+        int count = state->object_count;
+        bool game_over = false;
+        long ticks = 50000000L / count;
+        ticks = ticks < 20 ? 20 : ticks > 5000 ? 5000 : ticks;
+        for (long tick = 0; tick < 5; tick++) {
+            apply_script(state, default_script, sizeof(default_script) / sizeof(input_step), tick);
+            state->update(&game_over);
+        };
+        auto begin = std::chrono::steady_clock::now();
+        for (long tick = 0; tick < ticks; tick++) {
+            apply_script(state, default_script, sizeof(default_script) / sizeof(input_step), tick);
+            state->update(&game_over);
+        };
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / ticks;
+        printf("%10i %10li %14.0f %14.1f %12.2f\n", count, ticks, ns, 1e9 / ns, ns / count);
+        delete state;
+    };
+};
+
+// Measures the per tick cost of finding and resolving orb collisions with the sweep and prune as orbs are added, next to
+// testing every pair of orbs for the counts where that finishes in reasonable time. Orbs are scattered evenly through a
+// box that grows with them, one per collision_benchmark_spacing cube, so every count is equally crowded
+// contacts counts the approaching pairs resolved each tick, and touching every overlapping pair in the last one
+
+void run_collision_benchmark(unsigned int seed, thread_pool *pool) {
+    const int counts[] = {4096, 16384, 65536, 131072};
+    const int ticks = 50;
+    printf("Orb collisions on %i threads\n", pool->size);
+    printf("%10s %12s %14s %12s %26s\n", "orbs", "contacts", "sweep ns", "ns/orb", "all pairs ns (touching)");
+    for (int count : counts) {
+        scenario world = default_scenario(count);
+        float half = collision_benchmark_spacing * cbrt(static_cast<float>(count)) / 2;
+        world.low = {-half, -half, -half};
+        world.high = {half, half, half};
+        world.orb_collisions = true;
+        gameState *state = new gameState(world);
+        state->seed = seed;
+        state->pool = pool;
+        state->initialise();
+        state->populate(count);
+        for (int i = 0; i < count; i++) {
+            random_stream stream = make_stream(seed, i, -1);
+            state->objects.x[i] = random_place(-half, half, &stream);
+            state->objects.y[i] = random_place(-half, half, &stream);
+            state->objects.z[i] = random_place(-half, half, &stream);
+            state->objects.moved[i] = i;
+        };
+        update_grid(&state->grid, &state->objects, state->objects.moved, count);
+        // Collisions are run by hand after each tick, given the orbs it respawned as in the game, so that they can be timed
+        // on their own. The first tick sorts every orb from scratch and is left out
+        state->world.orb_collisions = false;
+        bool game_over = false;
+        state->update(&game_over);
+        state->collide_orbs(state->respawned);
+        double sweep = 0;
+        long contacts = 0;
+        for (int tick = 0; tick < ticks; tick++) {
+            state->update(&game_over);
+            auto begin = std::chrono::steady_clock::now();
+            state->collide_orbs(state->respawned);
+            sweep += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            for (std::vector<int> &band : state->sweep.contacts) {
+                contacts += band.size() / 2;
+            };
+        };
+        char all_pairs[32] = "-";
+        if (count <= 16384) {
+            orb_storage *orbs = &state->objects;
+            long touching = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (int a = 0; a < count; a++) {
+                for (int b = a + 1; b < count; b++) {
+                    float dx = orbs->x[b] - orbs->x[a];
+                    float dy = orbs->y[b] - orbs->y[a];
+                    float dz = orbs->z[b] - orbs->z[a];
+                    float reach = orbs->radius[a] + orbs->radius[b];
+                    touching += dx * dx + dy * dy + dz * dz < reach * reach;
+                };
+            };
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            snprintf(all_pairs, sizeof(all_pairs), "%.0f (%li)", ns, touching);
+        };
+        printf("%10i %12.1f %14.0f %12.2f %26s\n", count, static_cast<double>(contacts) / ticks, sweep / ticks, sweep / ticks / count, all_pairs);
+        delete state;
+    };
+};
+
+// Measures the per frame cost of depth ordering, comparing the radix draw order with a comparison sort of the same orbs
+
+void run_sort_benchmark(unsigned int seed) {
+    const int counts[] = {scenario_max_objects, 10000, 100000};
+    const int frames = 300;
+    printf("%10s %10s %18s %18s\n", "orbs", "visible", "radix ns", "std::sort ns");
+    for (int count : counts) {
+        gameState *state = new gameState(default_scenario(count));
+        state->seed = seed;
+        state->initialise();
+        state->populate(count);
+        bool game_over = false;
+        std::vector<view_orb> scratch;
+        double radix = 0;
+        double comparison = 0;
+        long visible = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            apply_script(state, default_script, sizeof(default_script) / sizeof(input_step), frame);
+            state->update(&game_over);
+            int visible_count = state->view_frame(benchmark_window_size, benchmark_window_size);
+            visible += visible_count;
+            scratch.assign(state->order.begin(), state->order.begin() + visible_count);
+            auto begin = std::chrono::steady_clock::now();
+            std::sort(scratch.begin(), scratch.end(), further);
+            auto middle = std::chrono::steady_clock::now();
+            sort_draw_order(&state->draw, state->order.data(), visible_count);
+            auto end = std::chrono::steady_clock::now();
+            comparison += std::chrono::duration<double, std::nano>(middle - begin).count();
+            radix += std::chrono::duration<double, std::nano>(end - middle).count();
+        };
+        printf("%10i %10li %18.0f %18.0f\n", count, visible / frames, radix / frames, comparison / frames);
+        delete state;
+    };
+};
+
+// Measures the per frame cost of drawing the visible orbs on the CPU, on one thread and with the tiles split across pool
+
+void run_raster_benchmark(unsigned int seed, thread_pool *pool) {
+    const int counts[] = {scenario_max_objects, 10000, 100000};
+    const int frames = 100;
+    framebuffer frame = {};
+    resize_framebuffer(&frame, benchmark_window_size, benchmark_window_size);
+    std::string threaded = std::to_string(pool->size) + " threads ns";
+    printf("Software rasteriser at %ix%i\n", frame.w, frame.h);
+    printf("%10s %10s %18s %18s\n", "orbs", "visible", "1 thread ns", threaded.c_str());
+    for (int count : counts) {
+        gameState *state = new gameState(default_scenario(count));
+        state->seed = seed;
+        state->initialise();
+        state->populate(count);
+        bool game_over = false;
+        double single = 0;
+        double parallel = 0;
+        long visible = 0;
+        for (int tick = 0; tick < frames; tick++) {
+            apply_script(state, default_script, sizeof(default_script) / sizeof(input_step), tick);
+            state->update(&game_over);
+            int visible_count = state->view_frame(frame.h, frame.w);
+            sort_draw_order(&state->draw, state->order.data(), visible_count);
+            visible += visible_count;
+            auto begin = std::chrono::steady_clock::now();
+            raster_frame(&frame, state->order.data(), visible_count, NULL);
+            auto middle = std::chrono::steady_clock::now();
+            raster_frame(&frame, state->order.data(), visible_count, pool);
+            auto end = std::chrono::steady_clock::now();
+            single += std::chrono::duration<double, std::nano>(middle - begin).count();
+            parallel += std::chrono::duration<double, std::nano>(end - middle).count();
+        };
+        printf("%10i %10li %18.0f %18.0f\n", count, visible / frames, single / frames, parallel / frames);
+        delete state;
+    };
+};
+
+#ifndef HEADLESS
+
+// Keeps frames to the display rate. With vsync the present call does the waiting, but if frames keep missing the refresh
+// vsync is switched off in favour of sleeping to the same rate, and back on once frames are comfortably fast again
+
+struct frame_pacer {
+    double period;
+    double frame_start;
+    bool vsync;
+    bool vsync_wanted;
+    int missed;
+    int recovered;
+};
+
+// Starts pacing at frames_per_second, or unpaced if that is 0
+
+void start_pacer(frame_pacer *pacer, int frames_per_second, bool vsync) {
+    pacer->period = frames_per_second > 0 ? 1.0 / frames_per_second : 0;
+    pacer->frame_start = now_seconds();
+    pacer->vsync = vsync;
+    pacer->vsync_wanted = vsync;
+    pacer->missed = 0;
+    pacer->recovered = 0;
+};
+
+// Called after presenting a frame, sleeps as needed to hold the frame rate and starts timing the next frame
+// work is how long the frame took before presenting
+
+void pace_frame(frame_pacer *pacer, SDL_Renderer *renderer, double work) {
+    if (pacer->vsync_wanted && pacer->period > 0) {
+        if (pacer->vsync) {
+            pacer->missed = now_seconds() - pacer->frame_start > pacer->period * 1.5 ? pacer->missed + 1 : 0;
+            if (pacer->missed >= vsync_miss_limit) {
+                SDL_RenderSetVSync(renderer, 0);
+                pacer->vsync = false;
+                pacer->recovered = 0;
+            };
+        } else {
+            pacer->recovered = work < pacer->period * 0.8 ? pacer->recovered + 1 : 0;
+            if (pacer->recovered >= vsync_recover_frames) {
+                SDL_RenderSetVSync(renderer, 1);
+                pacer->vsync = true;
+                pacer->missed = 0;
+            };
+        };
+    };
+    if (!pacer->vsync && pacer->period > 0) {
+        double wait = pacer->frame_start + pacer->period - now_seconds();
+        if (wait > 0.002) {
+            SDL_Delay(static_cast<Uint32>((wait - 0.001) * 1000.0));
+        };
+        while (now_seconds() < pacer->frame_start + pacer->period) {
+        };
+    };
+    pacer->frame_start = now_seconds();
+};
+
+#endif
+
 // Main library intialisation and game looop
 
 int main(int argc, char *argv[]) {
-    srand(time(NULL));
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-        printf("error initializing SDL: %s\n", SDL_GetError());
+#ifndef HEADLESS
+    double launched = now_seconds();
+#endif
+    unsigned int seed = time(NULL);
+    bool seeded = false;
+    bool benchmark = false;
+    long max_ticks = -1;
+    int threads = std::thread::hardware_concurrency();
+    float tick_seconds = millisecond_frame_delay / 1000.0f;
+#ifndef HEADLESS
+    bool vsync = false;
+    int frames_per_second = default_frame_rate;
+#endif
+    const char *replay_path = NULL;
+    bool render_replay = false;
+    input_recording recording = {};
+    scenario world = default_scenario();
+    const char *world_path = NULL;
+    const char *save_world_path = NULL;
+    world_file prewarmed = {};
+    int batch_games = 0;
+    const autopilot *pilot = find_autopilot("script");
+    frame_dump frame_output = {directory : NULL, every : 0, size : benchmark_window_size, start_tick : -1, drawn : 0, hash : 14695981039346656037ULL,
+                               buffer : {}};
+#ifndef HEADLESS
+    bool software = false;
+    const char *latency_path = NULL;
+#endif
+    const char *serve_path = NULL;
+    const char *spectate_path = NULL;
+    int spectator_rate = default_spectator_rate;
+#ifdef HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+            seeded = true;
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            max_ticks = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+            char *end;
+            tick_seconds = strtof(argv[++i], &end) / 1000.0f;
+            if (*end != '\0' || !(tick_seconds > 0) || !std::isfinite(tick_seconds)) {
+                printf("Error: --tick-ms takes a positive number of milliseconds, not %s\n", argv[i]);
+                return 1;
+            };
+#ifndef HEADLESS
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            frames_per_second = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            vsync = true;
+#endif
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recording.path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            if (!load_scenario(&world, argv[++i])) {
+                return 1;
+            };
+        } else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) {
+            world_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-world") == 0 && i + 1 < argc) {
+            save_world_path = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_games = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--autopilot") == 0 && i + 1 < argc) {
+            pilot = find_autopilot(argv[++i]);
+            if (pilot == NULL) {
+                printf("Unknown autopilot %s. Choose from:", argv[i]);
+                for (const autopilot &known : autopilots) {
+                    printf(" %s", known.name);
+                };
+                printf("\n");
+                return 1;
+            };
+        } else if (strcmp(argv[i], "--render") == 0) {
+            render_replay = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frame_output.directory = argv[++i];
+        } else if (strcmp(argv[i], "--frame-every") == 0 && i + 1 < argc) {
+            frame_output.every = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc) {
+            frame_output.size = max(strtol(argv[++i], NULL, 10), 1);
+#ifndef HEADLESS
+        } else if (strcmp(argv[i], "--software") == 0) {
+            software = true;
+        } else if (strcmp(argv[i], "--latency-log") == 0 && i + 1 < argc) {
+            latency_path = argv[++i];
+#endif
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--spectate") == 0 && i + 1 < argc) {
+            spectate_path = argv[++i];
+        } else if (strcmp(argv[i], "--spectator-rate") == 0 && i + 1 < argc) {
+            spectator_rate = max(strtol(argv[++i], NULL, 10), 1);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+#ifdef PROFILE
+            profile_path = argv[++i];
+            atexit(export_profile_at_exit);
+#else
+            i++;
+            printf("Built without profiling, so no profile will be written. Rebuild with CXXFLAGS=-DPROFILE\n");
+#endif
+        } else {
+            printf("Usage: %s [--headless] [--benchmark] [--seed N] [--ticks N] [--tick-ms N]"
+#ifndef HEADLESS
+                   " [--fps N] [--vsync]"
+#endif
+                   " [--threads N]"
+                   " [--scenario FILE] [--world FILE] [--save-world FILE] [--batch N] [--autopilot NAME] [--record FILE] [--replay FILE [--render]] [--profile FILE]"
+                   " [--frames DIR] [--frame-every N] [--frame-size N]"
+#ifndef HEADLESS
+                   " [--software] [--latency-log FILE]"
+#endif
+                   " [--serve SOCKET] [--spectate SOCKET] [--spectator-rate N]\n", argv[0]);
+            return 1;
+        };
+    };
+    thread_pool pool(threads);
+    if (frame_output.directory != NULL && frame_output.every <= 0) {
+        frame_output.every = default_frame_every;
+    };
+    frame_dump *dump = frame_output.every > 0 ? &frame_output : NULL;
+    if (spectate_path != NULL && headless) {
+        watch_headless(spectate_path, spectator_rate);
+        return 0;
+    };
+    if (save_world_path != NULL) {
+        return build_world(seeded ? seed : default_seed, max_ticks, tick_seconds, &world, &pool, save_world_path) ? 0 : 1;
+    };
+    // A saved world brings its own scenario and seed
+    if (world_path != NULL) {
+        if (!map_world(&prewarmed, world_path) || !check_world(&prewarmed, &pool)) {
+            return 1;
+        };
+        world = prewarmed.header->world;
+    };
+    if (benchmark) {
+        run_benchmark(seeded ? seed : default_seed, &pool, world_path != NULL ? &prewarmed : NULL);
+        run_sort_benchmark(seeded ? seed : default_seed);
+        run_raster_benchmark(seeded ? seed : default_seed, &pool);
+        run_collision_benchmark(seeded ? seed : default_seed, &pool);
+        return 0;
+    };
+    if (replay_path != NULL && !load_recording(&recording, replay_path)) {
+        return 1;
+    };
+    if (replay_path != NULL && (headless || !render_replay)) {
+        std::function<void(gameState *)> frame = NULL;
+        if (dump != NULL) {
+            frame = [&](gameState *replayed) { dump_frame(dump, replayed); };
+        };
+        bool matched = run_replay(&recording, &pool, world_path != NULL ? &prewarmed : NULL, frame);
+        if (dump != NULL) {
+            report_frames(dump);
+        };
+        return matched ? 0 : 1;
+    };
+    if (batch_games > 0) {
+        run_batch(seeded ? seed : default_seed, batch_games, max_ticks < 0 ? batch_max_ticks : max_ticks, tick_seconds, &world, &pool,
+                  world_path != NULL ? &prewarmed : NULL, pilot);
+        return 0;
+    };
+    spectator_server server = {};
+    spectator_server *spectators = NULL;
+    if (serve_path != NULL && spectate_path == NULL) {
+        if (!start_spectators(&server, serve_path)) {
+            return 1;
+        };
+        spectators = &server;
+    };
+    if (headless) {
+        run_headless(seeded ? seed : default_seed, max_ticks < 0 ? 100000 : max_ticks, tick_seconds, &world, &pool,
+                     recording.path != NULL ? &recording : NULL, world_path != NULL ? &prewarmed : NULL, pilot, dump, spectators);
+        if (spectators != NULL) {
+            stop_spectators(spectators);
+        };
+        return 0;
     };
-    if (TTF_Init() < 0) {
-        printf("Error initializing SDL_ttf: %s\n", TTF_GetError());
+    int status = 0;
+#ifndef HEADLESS
+    // Only the subsystems every run needs are started, as starting audio, controllers and the rest costs time before the
+    // first frame. Anything that needs another should start it with SDL_InitSubSystem when it is first used
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
+        printf("error initializing SDL: %s\n", SDL_GetError());
     };
-    TTF_Font *font = TTF_OpenFont("LiberationSerif-Regular.ttf", 24);
     SDL_Color cyan = {0, 100, 100};
     SDL_DisplayMode DisplayMode;
     SDL_GetCurrentDisplayMode(0, &DisplayMode);
@@ -508,23 +4785,102 @@ int main(int argc, char *argv[]) {
                                           SDL_WINDOWPOS_CENTERED,
                                           SDL_WINDOWPOS_CENTERED,
                                           min(DisplayMode.w, DisplayMode.h), min(DisplayMode.w, DisplayMode.h), 0);
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    gameState state;
-    state.initialise();
-    bool game_over = false;
-    bool restarted = false;
-    while (true) {
-        handle_event(&state, &game_over, &restarted);
-        if (!game_over) {
-            if (restarted) {
-                state.initialise();
-                restarted = false;
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if (vsync && frames_per_second == default_frame_rate && DisplayMode.refresh_rate > 0) {
+        frames_per_second = DisplayMode.refresh_rate;
+    };
+    frameRenderer frames;
+    frames.launched = launched;
+    // The simulation thread keeps pool busy, so --software draws the orbs on a pool of its own
+    thread_pool *raster_pool = software ? new thread_pool(threads) : NULL;
+    frames.raster_pool = raster_pool;
+    if (spectate_path != NULL) {
+        // Spectators draw the streamed game as it arrives, taking input only to quit or show the profile
+        spectator_view view;
+        world_snapshot snapshot;
+        snapshot.tick = -1;
+        input_queue ignored;
+        start_input_queue(&ignored);
+        input_latch latch = {};
+        frame_pacer pacer;
+        start_pacer(&pacer, frames_per_second, vsync);
+        if (connect_spectator(&view, spectate_path, spectator_rate)) {
+            while (handle_event(&ignored, &latch, &frames.show_profile) && pump_spectator(&view, 0)) {
+                if (view.tick >= 0) {
+                    spectator_snapshot(&view, &snapshot);
+                };
+                pace_frame(&pacer, renderer, frames.render(renderer, window, &cyan, &snapshot));
+            };
+            report_spectator(&view);
+            close(view.socket);
+        } else {
+            status = 1;
+        };
+    } else if (replay_path != NULL) {
+        // Replays draw every tick as soon as it has run, not paced to the tick length
+        world_snapshot snapshot;
+        bool matched = run_replay(&recording, &pool, world_path != NULL ? &prewarmed : NULL, [&](gameState *replayed) {
+            replayed->take_snapshot(&snapshot, false, now_seconds() - replayed->tick_seconds);
+            frames.render(renderer, window, &cyan, &snapshot);
+            SDL_PumpEvents();
+        });
+        status = matched ? 0 : 1;
+    } else {
+        gameState *state = new gameState(world);
+        state->seed = seed;
+        state->pool = &pool;
+        state->tick_seconds = tick_seconds;
+        state->prewarmed = world_path != NULL ? &prewarmed : NULL;
+        state->initialise();
+        // The simulation runs on its own thread and hands the render loop a snapshot after each batch of ticks, so a frame
+        // costs the longer of the two rather than both, and a slow present never holds up the physics
+        input_queue inputs;
+        start_input_queue(&inputs);
+        snapshot_exchange exchange;
+        start_exchange(&exchange);
+        std::atomic<bool> running(true);
+        std::thread simulation(run_simulation, state, &inputs, &exchange, &running, recording.path != NULL ? &recording : NULL,
+                               spectators);
+        // Frames turn the view by the keys held as they start, and time each key change until it is on screen
+        input_latch latch = {};
+        frames.latch = &latch;
+        if (latency_path != NULL) {
+            frames.latency_log = fopen(latency_path, "w");
+            if (frames.latency_log == NULL) {
+                printf("Error writing latency log %s\n", latency_path);
+            } else {
+                fprintf(frames.latency_log, "event_seconds,latency_ms\n");
+            };
+        };
+        frame_pacer pacer;
+        start_pacer(&pacer, frames_per_second, vsync);
+        while (true) {
+            {
+                PROFILE_SCOPE(phase_events);
+                if (!handle_event(&inputs, &latch, &frames.show_profile)) {
+                    break;
+                };
             };
-            state.update(&game_over);
-            state.render(renderer, window, font, &cyan);
+            double work = frames.render(renderer, window, &cyan, latest_snapshot(&exchange));
+            PROFILE_SCOPE(phase_pace);
+            pace_frame(&pacer, renderer, work);
+        };
+        running = false;
+        simulation.join();
+        if (spectators != NULL) {
+            stop_spectators(spectators);
         };
-        SDL_Delay(millisecond_frame_delay);
+        frames.report_latency();
+        if (frames.latency_log != NULL) {
+            fclose(frames.latency_log);
+        };
+        delete state;
     };
+    delete raster_pool;
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+#endif
 
-    return 0;
+    return status;
 };
\ No newline at end of file